@@ -0,0 +1,168 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMultiMap>
+#include <string.h>
+#include <stdio.h>
+#include "httpheaderscanner.h"
+
+namespace stefanfrings {
+
+/**
+   Compares the ways to find the header lines of a request: HttpHeaderScanner with
+   SIMD instructions, its scalar loop, memchr() per line and field, and the readLine()
+   parser of older versions, which also built the header map.
+   <p>
+   Build it with the CMake option QTWEBAPP_BENCHMARKS=ON and run it without arguments.
+   It prints the average time to parse one header block.
+ */
+
+class HttpHeaderScannerBenchmark {
+public:
+
+    /** Measure all parsers with one header block */
+    static void run( const char* name, const QByteArray& block ) {
+        printf( "%s (%i bytes):\n", name, int( block.size() ) );
+        measure( "  simd    ", block, &scanSimd );
+        measure( "  scalar  ", block, &scanScalar );
+        measure( "  memchr  ", block, &scanMemchr );
+        measure( "  readLine", block, &scanReadLine );
+    }
+
+private:
+
+    /** Number of parsed blocks per measurement */
+    static const int ITERATIONS = 200000;
+
+    typedef int ( *Parser )( const QByteArray& block );
+
+    static void measure( const char* label, const QByteArray& block, const Parser function ) {
+        // Called through a volatile pointer, so the compiler cannot move the work out of the loops
+        Parser volatile parser = function;
+        // Warm up the caches and the branch predictor
+        int sink = 0;
+        for ( int i = 0; i < ITERATIONS / 10; ++i ) {
+            sink += parser( block );
+        }
+        QElapsedTimer timer;
+        timer.start();
+        for ( int i = 0; i < ITERATIONS; ++i ) {
+            sink += parser( block );
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        result = sink;
+        printf( "%s %8.1f ns\n", label, double( elapsed ) / ITERATIONS );
+    }
+
+    /** Receives the results, so the compiler cannot drop the parsers */
+    static volatile int result;
+
+    /** Combine the positions of the lines into one number */
+    static int checksum( const HttpHeaderLine* lines, const int count ) {
+        int sum = 0;
+        for ( int i = 0; i < count; ++i ) {
+            sum += lines[i].end ^ lines[i].colon;
+        }
+        return sum;
+    }
+
+    static int scanSimd( const QByteArray& block ) {
+        HttpHeaderLine lines[64];
+        int count = HttpHeaderScanner::scan( block.constData(), 0, block.size(), lines, 64 );
+        return checksum( lines, count );
+    }
+
+    static int scanScalar( const QByteArray& block ) {
+        HttpHeaderLine lines[64];
+        int count = HttpHeaderScanner::scanScalar( block.constData(), 0, block.size(), lines, 64 );
+        return checksum( lines, count );
+    }
+
+    /** The parser before HttpHeaderScanner, two memchr() calls per line */
+    static int scanMemchr( const QByteArray& block ) {
+        HttpHeaderLine lines[64];
+        const char* buffer = block.constData();
+        int count = 0;
+        int pos = 0;
+        while ( count < 64 ) {
+            const char* newLine = static_cast<const char*>( memchr( buffer + pos, '\n', size_t( block.size() - pos ) ) );
+            if ( !newLine ) {
+                break;
+            }
+            int end = int( newLine - buffer );
+            const char* colon = static_cast<const char*>( memchr( buffer + pos, ':', size_t( end - pos ) ) );
+            lines[count].end = end;
+            lines[count].colon = colon ? int( colon - buffer ) : -1;
+            ++count;
+            pos = end + 1;
+        }
+        return checksum( lines, count );
+    }
+
+    /** The parser of older versions, one readLine() from the socket per line */
+    static int scanReadLine( const QByteArray& block ) {
+        QBuffer socket;
+        socket.setData( block );
+        socket.open( QIODevice::ReadOnly );
+        QMultiMap<QByteArray, QByteArray> headers;
+        QByteArray lineBuffer;
+        int count = 0;
+        while ( socket.canReadLine() ) {
+            lineBuffer.append( socket.readLine( 16001 ) );
+            if ( !lineBuffer.contains( "\r\n" ) ) {
+                continue;
+            }
+            ++count;
+            QByteArray newData = lineBuffer.trimmed();
+            lineBuffer.clear();
+            int colon = newData.indexOf( ':' );
+            if ( colon > 0 ) {
+                headers.insert( newData.left( colon ).toLower(), newData.mid( colon + 1 ).trimmed() );
+            }
+        }
+        return count + headers.size();
+    }
+};
+
+volatile int HttpHeaderScannerBenchmark::result = 0;
+
+} // end of namespace
+
+using namespace stefanfrings;
+
+int main() {
+    // Typical request of a web browser
+    const QByteArray browser(
+        "GET /images/logo.png HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: de-DE,de;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: sessionid=4f3c2a1b0e9d8c7b6a5f4e3d2c1b0a99; theme=dark\r\n"
+        "Referer: https://www.example.com/index.html\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "\r\n" );
+
+    // Typical request of a program that calls a REST API
+    const QByteArray api(
+        "POST /api/v1/quotes HTTP/1.1\r\n"
+        "Host: api.example.com\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 42\r\n"
+        "Accept: */*\r\n"
+        "\r\n" );
+
+    HttpHeaderScannerBenchmark::run( "Browser", browser );
+    HttpHeaderScannerBenchmark::run( "API client", api );
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpacceptor.h"
+#include <QHostAddress>
+#include <QTcpSocket>
+#if defined( Q_OS_UNIX )
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+    #include <string.h>
+#endif
+
+using namespace stefanfrings;
+
+HttpAcceptor::HttpAcceptor( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler ) :
+    QTcpServer(),
+    m_config( config ),
+    m_requestHandler( requestHandler ),
+    m_pool( nullptr ),
+    m_thread( new QThread ) {
+
+    Q_ASSERT( config != nullptr );
+    Q_ASSERT( requestHandler != nullptr );
+    m_thread->start();
+    moveToThread( m_thread );
+}
+
+HttpAcceptor::~HttpAcceptor() {
+    m_thread->quit();
+    m_thread->wait();
+    delete m_thread;
+#ifdef SUPERVERBOSE
+    qDebug( "HttpAcceptor (%p): destroyed", static_cast<void*>( this ) );
+#endif
+}
+
+bool HttpAcceptor::isSupported() {
+#if defined( Q_OS_UNIX ) && defined( SO_REUSEPORT )
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool HttpAcceptor::start() {
+    Q_ASSERT( QThread::currentThread() == m_thread );
+    if ( !m_pool ) {
+        m_pool = new HttpConnectionHandlerPool( m_config, m_requestHandler );
+    }
+    const HttpServerConfig* config = m_config->get();
+    quint16 port = config->port;
+    tSocketDescriptor socketDescriptor = openSocket( config->host, port );
+    if ( socketDescriptor == -1 || !setSocketDescriptor( socketDescriptor ) ) {
+        qCritical( "HttpAcceptor (%p): Cannot bind on port %i", static_cast<void*>( this ), port );
+        return false;
+    }
+#ifdef SUPERVERBOSE
+    qDebug( "HttpAcceptor (%p): Listening on port %i", static_cast<void*>( this ), port );
+#endif
+    return true;
+}
+
+void HttpAcceptor::stop() {
+    Q_ASSERT( QThread::currentThread() == m_thread );
+    close();
+    delete m_pool;
+    m_pool = nullptr;
+}
+
+tSocketDescriptor HttpAcceptor::openSocket( const QString& host, const quint16 port ) const {
+#if defined( Q_OS_UNIX ) && defined( SO_REUSEPORT )
+    QHostAddress address = host.isEmpty() ? QHostAddress( QHostAddress::AnyIPv6 ) : QHostAddress( host );
+    bool ipv6 = address.protocol() == QAbstractSocket::IPv6Protocol;
+    int fd = ::socket( ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0 );
+    if ( fd == -1 && host.isEmpty() ) {
+        // No IPv6 support, fall back to IPv4 only
+        address = QHostAddress( QHostAddress::AnyIPv4 );
+        ipv6 = false;
+        fd = ::socket( AF_INET, SOCK_STREAM, 0 );
+    }
+    if ( fd == -1 ) {
+        return -1;
+    }
+
+    int on = 1;
+    ::setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    if ( ::setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof( on ) ) != 0 ) {
+        ::close( fd );
+        return -1;
+    }
+
+    int result;
+    if ( ipv6 ) {
+        if ( host.isEmpty() ) {
+            // Accept IPv4 connections as well, like QHostAddress::Any does
+            int off = 0;
+            ::setsockopt( fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof( off ) );
+        }
+        struct sockaddr_in6 sockAddr;
+        memset( &sockAddr, 0, sizeof( sockAddr ) );
+        sockAddr.sin6_family = AF_INET6;
+        sockAddr.sin6_port = htons( port );
+        Q_IPV6ADDR ip = address.toIPv6Address();
+        memcpy( &sockAddr.sin6_addr, &ip, sizeof( ip ) );
+        result = ::bind( fd, reinterpret_cast<struct sockaddr*>( &sockAddr ), sizeof( sockAddr ) );
+    } else {
+        struct sockaddr_in sockAddr;
+        memset( &sockAddr, 0, sizeof( sockAddr ) );
+        sockAddr.sin_family = AF_INET;
+        sockAddr.sin_port = htons( port );
+        sockAddr.sin_addr.s_addr = htonl( address.toIPv4Address() );
+        result = ::bind( fd, reinterpret_cast<struct sockaddr*>( &sockAddr ), sizeof( sockAddr ) );
+    }
+    if ( result != 0 || ::listen( fd, SOMAXCONN ) != 0 ) {
+        ::close( fd );
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED( host )
+    Q_UNUSED( port )
+    return -1;
+#endif
+}
+
+void HttpAcceptor::incomingConnection( tSocketDescriptor socketDescriptor ) {
+#ifdef SUPERVERBOSE
+    qDebug( "HttpAcceptor (%p): New connection", static_cast<void*>( this ) );
+#endif
+
+    HttpConnectionHandler* freeHandler = nullptr;
+    if ( m_pool ) {
+        freeHandler = m_pool->getConnectionHandler();
+    }
+
+    // Let the handler process the new connection.
+    if ( freeHandler ) {
+        // The descriptor is passed via event queue because the handler lives in another thread
+        QMetaObject::invokeMethod( freeHandler, "handleConnection", Qt::QueuedConnection, Q_ARG( stefanfrings::tSocketDescriptor, socketDescriptor ) );
+
+        return;
+    }
+
+    // Reject the connection
+    qDebug( "HttpAcceptor (%p): Too many incoming connections", static_cast<void*>( this ) );
+    QTcpSocket* socket = new QTcpSocket( this );
+    socket->setSocketDescriptor( socketDescriptor );
+    connect( socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater );
+    socket->write( "HTTP/1.1 503 too many connections\r\nConnection: close\r\n\r\nToo many connections\r\n" );
+    socket->disconnectFromHost();
+}
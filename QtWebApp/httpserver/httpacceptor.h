@@ -0,0 +1,91 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPACCEPTOR_H
+#define HTTPACCEPTOR_H
+
+#include <QTcpServer>
+#include <QThread>
+#include "httpglobal.h"
+#include "httpconnectionhandler.h"
+#include "httpconnectionhandlerpool.h"
+#include "httprequesthandler.h"
+#include "httpserverconfig.h"
+
+namespace stefanfrings {
+
+/**
+   One of several accept loops of a HttpListener in multi-acceptor mode.
+   <p>
+   Each acceptor runs in its own thread, opens its own listening socket with the
+   SO_REUSEPORT option on the configured host and port, and owns a private
+   HttpConnectionHandlerPool. The operating system spreads incoming connections
+   over all sockets that share the port, so accepting connections scales with the
+   number of CPU cores and no lock is shared between the acceptors.
+   <p>
+   The limits of the connection handler pool (maxThreads, maxConnections) apply
+   to each acceptor separately.
+   @see HttpListener for the acceptThreads setting
+ */
+
+class DECLSPEC HttpAcceptor : public QTcpServer {
+    Q_OBJECT
+    Q_DISABLE_COPY( HttpAcceptor )
+
+public:
+    /**
+       Constructor. Starts the thread of the acceptor, but does not listen yet.
+       @param config Configuration of the HTTP server. Must not be 0.
+       @param requestHandler Processes each received HTTP request.
+     */
+    HttpAcceptor( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler );
+
+    /** Destructor, stops the thread of the acceptor. Call stop() before. */
+    virtual ~HttpAcceptor();
+
+    /** Returns true, if the operating system supports multiple sockets on the same port. */
+    static bool isSupported();
+
+public slots:
+    /**
+       Open the listening socket and create the connection handler pool.
+       Must be executed in the thread of the acceptor.
+       @return true on success
+     */
+    bool start();
+
+    /**
+       Close the listening socket and delete the connection handler pool.
+       Must be executed in the thread of the acceptor.
+     */
+    void stop();
+
+protected:
+    /** Serves new incoming connection requests */
+    void incomingConnection( tSocketDescriptor socketDescriptor ) override;
+
+private:
+    /** Configuration of the HTTP server */
+    const HttpServerConfigHolder* m_config;
+
+    /** Point to the reuqest handler which processes all HTTP requests */
+    HttpRequestHandler* m_requestHandler;
+
+    /** Private pool of connection handlers of this acceptor */
+    HttpConnectionHandlerPool* m_pool;
+
+    /** The thread that runs the accept loop */
+    QThread* m_thread;
+
+    /**
+       Create a listening socket with SO_REUSEPORT.
+       @return socket descriptor, or -1 on error
+     */
+    tSocketDescriptor openSocket( const QString& host, const quint16 port ) const;
+};
+
+} // end of namespace
+
+#endif // HTTPACCEPTOR_H
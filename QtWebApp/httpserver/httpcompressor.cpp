@@ -0,0 +1,176 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpcompressor.h"
+#include <QList>
+#ifdef QTWEBAPP_ZLIB
+    #include <zlib.h>
+#endif
+
+using namespace stefanfrings;
+
+#ifdef QTWEBAPP_ZLIB
+/** Initialize a zlib stream, windowBits 15 produces the zlib format (deflate), 31 the gzip format */
+static z_stream* createStream( const HttpCompressor::Encoding encoding, const int level ) {
+    z_stream* stream = new z_stream;
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    int windowBits = encoding == HttpCompressor::GZIP ? 15 + 16 : 15;
+    if ( deflateInit2( stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+        qCritical( "HttpCompressor: cannot initialize zlib" );
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
+
+/** Pass input through a zlib stream and return the output */
+static QByteArray deflateStream( z_stream* stream, const QByteArray& data, const int flush ) {
+    QByteArray output;
+    char buffer[16384];
+    stream->next_in = reinterpret_cast<Bytef*>( const_cast<char*>( data.constData() ) );
+    stream->avail_in = uInt( data.size() );
+    do {
+        stream->next_out = reinterpret_cast<Bytef*>( buffer );
+        stream->avail_out = sizeof( buffer );
+        int result = deflate( stream, flush );
+        if ( result == Z_STREAM_ERROR ) {
+            qCritical( "HttpCompressor: zlib error" );
+            return QByteArray();
+        }
+        output.append( buffer, int( sizeof( buffer ) - stream->avail_out ) );
+    } while ( stream->avail_out == 0 );
+    return output;
+}
+#endif
+
+bool HttpCompressor::isSupported() {
+#ifdef QTWEBAPP_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+HttpCompressor::Encoding HttpCompressor::negotiate( const QByteArray& acceptEncoding ) {
+    if ( !isSupported() || acceptEncoding.isEmpty() ) {
+        return IDENTITY;
+    }
+    if ( accepts( acceptEncoding, GZIP ) ) {
+        return GZIP;
+    }
+    if ( accepts( acceptEncoding, DEFLATE ) ) {
+        return DEFLATE;
+    }
+    return IDENTITY;
+}
+
+bool HttpCompressor::accepts( const QByteArray& acceptEncoding, const Encoding encoding ) {
+    if ( encoding == IDENTITY ) {
+        return true;
+    }
+    // Example: "gzip;q=1.0, deflate;q=0.5, *;q=0"
+    bool listed = false;
+    bool accepted = false;
+    bool wildcard = false;
+    const QList<QByteArray> list = acceptEncoding.split( ',' );
+    for ( const QByteArray& part : list ) {
+        QByteArray coding = part;
+        bool positive = true;
+        int semicolon = part.indexOf( ';' );
+        if ( semicolon >= 0 ) {
+            coding = part.left( semicolon );
+            QByteArray parameter = part.mid( semicolon + 1 ).trimmed();
+            if ( parameter.startsWith( "q=" ) ) {
+                positive = parameter.mid( 2 ).toDouble() > 0;
+            }
+        }
+        coding = coding.trimmed().toLower();
+        if ( coding == name( encoding ) || ( encoding == GZIP && coding == "x-gzip" ) ) {
+            listed = true;
+            accepted = positive;
+        } else if ( coding == "*" ) {
+            wildcard = positive;
+        }
+    }
+    return listed ? accepted : wildcard;
+}
+
+QByteArray HttpCompressor::name( const Encoding encoding ) {
+    switch ( encoding ) {
+    case GZIP:
+        return "gzip";
+    case DEFLATE:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+bool HttpCompressor::isCompressible( const QByteArray& contentType ) {
+    return contentType.startsWith( "text/" ) || contentType.contains( "json" ) || contentType.contains( "javascript" )
+           || contentType.contains( "xml" ) || contentType.startsWith( "application/wasm" )
+           || contentType.startsWith( "application/x-font-ttf" ) || contentType.startsWith( "application/vnd.ms-fontobject" )
+           || contentType.startsWith( "application/font-otf" );
+}
+
+QByteArray HttpCompressor::compress( const QByteArray& data, const Encoding encoding, const int level ) {
+#ifdef QTWEBAPP_ZLIB
+    if ( encoding == IDENTITY ) {
+        return data;
+    }
+    z_stream* stream = createStream( encoding, level );
+    if ( !stream ) {
+        return QByteArray();
+    }
+    QByteArray output = deflateStream( stream, data, Z_FINISH );
+    deflateEnd( stream );
+    delete stream;
+    return output;
+#else
+    Q_UNUSED( encoding )
+    Q_UNUSED( level )
+    return encoding == IDENTITY ? data : QByteArray();
+#endif
+}
+
+HttpCompressor::HttpCompressor( const Encoding encoding, const int level ) :
+    m_stream( nullptr ) {
+#ifdef QTWEBAPP_ZLIB
+    if ( encoding != IDENTITY ) {
+        m_stream = createStream( encoding, level );
+    }
+#else
+    Q_UNUSED( encoding )
+    Q_UNUSED( level )
+#endif
+}
+
+HttpCompressor::~HttpCompressor() {
+#ifdef QTWEBAPP_ZLIB
+    z_stream* stream = static_cast<z_stream*>( m_stream );
+    if ( stream ) {
+        deflateEnd( stream );
+        delete stream;
+    }
+#endif
+}
+
+bool HttpCompressor::isValid() const {
+    return m_stream != nullptr;
+}
+
+QByteArray HttpCompressor::process( const QByteArray& data, const bool finish ) {
+#ifdef QTWEBAPP_ZLIB
+    z_stream* stream = static_cast<z_stream*>( m_stream );
+    if ( stream ) {
+        return deflateStream( stream, data, finish ? Z_FINISH : Z_NO_FLUSH );
+    }
+#else
+    Q_UNUSED( finish )
+#endif
+    return data;
+}
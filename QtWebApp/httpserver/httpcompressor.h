@@ -0,0 +1,89 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPCOMPRESSOR_H
+#define HTTPCOMPRESSOR_H
+
+#include <QByteArray>
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/**
+   Compresses HTTP response bodies with gzip or deflate, either at once or as a stream.
+   <p>
+   Compression requires zlib. If the library has been built without zlib,
+   isSupported() returns false and negotiate() always returns IDENTITY.
+ */
+
+class DECLSPEC HttpCompressor {
+    Q_DISABLE_COPY( HttpCompressor )
+public:
+
+    /** Content codings */
+    enum Encoding {IDENTITY, GZIP, DEFLATE};
+
+    /** Whether the library has been built with zlib */
+    static bool isSupported();
+
+    /**
+       Choose the content coding for a response.
+       @param acceptEncoding Value of the Accept-Encoding header of the request
+       @return GZIP or DEFLATE if accepted by the client, gzip is preferred. Otherwise IDENTITY.
+     */
+    static Encoding negotiate( const QByteArray& acceptEncoding );
+
+    /**
+       Check whether the client accepts a content coding, regardless whether zlib is available.
+       Used to deliver precompressed files.
+       @param acceptEncoding Value of the Accept-Encoding header of the request
+       @param encoding GZIP or DEFLATE
+     */
+    static bool accepts( const QByteArray& acceptEncoding, const Encoding encoding );
+
+    /** Name of the content coding for the Content-Encoding header */
+    static QByteArray name( const Encoding encoding );
+
+    /** Whether it is worth to compress content of the given type, e.g. text or JSON */
+    static bool isCompressible( const QByteArray& contentType );
+
+    /**
+       Compress a whole document.
+       @param data The document
+       @param encoding GZIP or DEFLATE
+       @param level Compression level 1-9
+       @return compressed document, empty in case of an error
+     */
+    static QByteArray compress( const QByteArray& data, const Encoding encoding, const int level = 6 );
+
+    /**
+       Constructor, prepares compression of a stream.
+       @param encoding GZIP or DEFLATE
+       @param level Compression level 1-9
+     */
+    HttpCompressor( const Encoding encoding, const int level = 6 );
+
+    /** Destructor */
+    virtual ~HttpCompressor();
+
+    /** Whether the stream has been initialized, otherwise process() would not compress */
+    bool isValid() const;
+
+    /**
+       Compress the next block of the stream.
+       @param data Uncompressed bytes
+       @param finish true for the last block
+       @return compressed bytes, may be empty because zlib collects input to compress it better
+     */
+    QByteArray process( const QByteArray& data, const bool finish );
+
+private:
+    /** State of zlib (z_stream), NULL if the stream could not be initialized */
+    void* m_stream;
+};
+
+} // end of namespace
+
+#endif // HTTPCOMPRESSOR_H
@@ -4,28 +4,60 @@
  */
 
 #include "httpconnectionhandler.h"
-#include "httpresponse.h"
+#include <QRunnable>
+
+namespace stefanfrings {
+
+/**
+   Executes the request handler for one request in a thread of the worker pool (reactor mode).
+ */
+class HttpServiceTask : public QRunnable {
+public:
+    explicit HttpServiceTask( HttpConnectionHandler* handler ) :
+        m_handler( handler ) {}
+
+    void run() override {
+        // The socket has been released by the event-loop thread, so it can be pulled into this thread.
+        m_handler->m_socket->moveToThread( QThread::currentThread() );
+        bool closeConnection = m_handler->serviceRequest();
+        m_handler->m_socket->moveToThread( m_handler->m_thread );
+        QMetaObject::invokeMethod( m_handler, "serviceFinished", Qt::QueuedConnection, Q_ARG( bool, closeConnection ) );
+    }
+
+private:
+    HttpConnectionHandler* m_handler;
+};
+
+} // end of namespace
 
 using namespace stefanfrings;
 
-HttpConnectionHandler::HttpConnectionHandler( const QSettings* settings, HttpRequestHandler* requestHandler, const QSslConfiguration* sslConfiguration ) :
+HttpConnectionHandler::HttpConnectionHandler( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler, const QSslConfiguration* sslConfiguration,
+                                              QThread* reactorThread, QThreadPool* workerPool ) :
     QObject(),
-    m_settings( settings ),
+    m_config( config ),
     m_socket( nullptr ),
-    m_thread( new QThread ),
+    m_thread( reactorThread ? reactorThread : new QThread ),
+    m_ownsThread( reactorThread == nullptr ),
+    m_workerPool( workerPool ),
+    m_inService( false ),
     m_currentRequest( nullptr ),
+    m_currentResponse( nullptr ),
+    m_closeAfterResponse( false ),
     m_requestHandler( requestHandler ),
-    m_busy( false ),
+    m_busy( 0 ),
     m_sslConfiguration( sslConfiguration ) {
 
-    Q_ASSERT( settings != nullptr );
+    Q_ASSERT( config != nullptr );
     Q_ASSERT( requestHandler != nullptr );
 
-    // execute signals in a new thread
-    m_thread->start();
+    // execute signals in a new thread, unless we share the thread of a reactor
+    if ( m_ownsThread ) {
+        m_thread->start();
 #ifdef SUPERVERBOSE
-    qDebug( "HttpConnectionHandler (%p): thread started", static_cast<void*>( this ) );
+        qDebug( "HttpConnectionHandler (%p): thread started", static_cast<void*>( this ) );
 #endif
+    }
     moveToThread( m_thread );
     m_readTimer.moveToThread( m_thread );
     m_readTimer.setSingleShot( true );
@@ -37,6 +69,7 @@ HttpConnectionHandler::HttpConnectionHandler( const QSettings* settings, HttpReq
     // Connect signals
     connect( m_socket, &QTcpSocket::readyRead, this, &HttpConnectionHandler::read );
     connect( m_socket, &QTcpSocket::disconnected, this, &HttpConnectionHandler::disconnected );
+    connect( m_socket, &QTcpSocket::bytesWritten, this, &HttpConnectionHandler::bytesWritten );
     connect( &m_readTimer, &QTimer::timeout, this, &HttpConnectionHandler::readTimeout );
     connect( m_thread, &QThread::finished, this, &HttpConnectionHandler::thread_done );
 
@@ -49,15 +82,23 @@ void HttpConnectionHandler::thread_done() {
     m_readTimer.stop();
     m_socket->close();
     delete m_socket;
+    m_socket = nullptr;
 #ifdef SUPERVERBOSE
     qDebug( "HttpConnectionHandler (%p): thread stopped", static_cast<void*>( this ) );
 #endif
 }
 
 HttpConnectionHandler::~HttpConnectionHandler() {
-    m_thread->quit();
-    m_thread->wait();
-    m_thread->deleteLater();
+    if ( m_ownsThread ) {
+        m_thread->quit();
+        m_thread->wait();
+        m_thread->deleteLater();
+    } else if ( m_socket ) {
+        // The shared reactor thread is still running, so the socket has not been deleted by thread_done()
+        m_socket->close();
+        delete m_socket;
+        m_socket = nullptr;
+    }
 #ifdef SUPERVERBOSE
     qDebug( "HttpConnectionHandler (%p): destroyed", static_cast<void*>( this ) );
 #endif
@@ -82,7 +123,7 @@ void HttpConnectionHandler::createSocket() {
 
 void HttpConnectionHandler::handleConnection( tSocketDescriptor socketDescriptor ) {
     qDebug( "HttpConnectionHandler (%p): handle new connection", static_cast<void*>( this ) );
-    m_busy = true;
+    Q_ASSERT( isBusy() ); // the pool must have reserved this handler
     Q_ASSERT( m_socket->isOpen() == false ); // if not, then the handler is already busy
 
     //UGLY workaround - we need to clear writebuffer before reusing this socket
@@ -93,6 +134,7 @@ void HttpConnectionHandler::handleConnection( tSocketDescriptor socketDescriptor
     if ( !m_socket->setSocketDescriptor( socketDescriptor ) ) {
         qCritical( "HttpConnectionHandler (%p): cannot initialize socket: %s",
                    static_cast<void*>( this ), qPrintable( m_socket->errorString() ) );
+        setIdle();
         return;
     }
 
@@ -105,19 +147,25 @@ void HttpConnectionHandler::handleConnection( tSocketDescriptor socketDescriptor
 #endif
 
     // Start timer for read timeout
-    int readTimeout = m_settings->value( "readTimeout", 10000 ).toInt();
-    m_readTimer.start( readTimeout );
+    m_readTimer.start( m_config->get()->readTimeout );
     // delete previous request
     delete m_currentRequest;
     m_currentRequest = nullptr;
 }
 
-bool HttpConnectionHandler::isBusy() {
-    return m_busy;
+bool HttpConnectionHandler::isBusy() const {
+    return m_busy.loadAcquire() != 0;
+}
+
+bool HttpConnectionHandler::setBusy() {
+    return m_busy.testAndSetOrdered( 0, 1 );
 }
 
-void HttpConnectionHandler::setBusy() {
-    this->m_busy = true;
+void HttpConnectionHandler::setIdle() {
+    // Only the transition from busy to idle returns the handler to the pool, so it is never released twice
+    if ( m_busy.testAndSetOrdered( 1, 0 ) ) {
+        emit released( this );
+    }
 }
 
 void HttpConnectionHandler::readTimeout() {
@@ -128,20 +176,60 @@ void HttpConnectionHandler::readTimeout() {
     //Commented out because QWebView cannot handle this.
     //socket->write("HTTP/1.1 408 request timeout\r\nConnection: close\r\n\r\n408 request timeout\r\n");
 
-    while ( m_socket->bytesToWrite() ) m_socket->waitForBytesWritten();
-    m_socket->disconnectFromHost();
+    if ( m_currentResponse ) {
+        // The client does not receive the response, so don't wait for it
+        delete m_currentResponse;
+        m_currentResponse = nullptr;
+        m_socket->abort();
+    } else {
+        // Pending output is sent before the connection gets closed
+        m_socket->disconnectFromHost();
+    }
     delete m_currentRequest;
     m_currentRequest = nullptr;
 }
 
 void HttpConnectionHandler::disconnected() {
+    if ( m_inService ) {
+        // The socket belongs to a worker thread at the moment, serviceFinished() will check the state.
+        return;
+    }
     qDebug( "HttpConnectionHandler (%p): disconnected", static_cast<void*>( this ) );
     m_socket->close();
     m_readTimer.stop();
-    m_busy = false;
+    delete m_currentResponse;
+    m_currentResponse = nullptr;
+    setIdle();
+}
+
+void HttpConnectionHandler::bytesWritten() {
+    if ( m_inService || !m_currentResponse ) {
+        return;
+    }
+    // The client makes progress, so restart the timeout
+    m_readTimer.start( m_config->get()->readTimeout );
+    if ( m_socket->bytesToWrite() > m_config->get()->writeLowWatermark ) {
+        return;
+    }
+    m_currentResponse->sendPendingOutput();
+    if ( !m_currentResponse->hasPendingOutput() ) {
+#ifdef SUPERVERBOSE
+        qDebug( "HttpConnectionHandler (%p): sent pending output", static_cast<void*>( this ) );
+#endif
+        finishRequest( m_closeAfterResponse );
+        // Process pipelined requests that arrived in the meantime
+        read();
+    }
 }
 
 void HttpConnectionHandler::read() {
+    if ( m_inService || m_currentResponse ) {
+        // Pipelined requests are processed after the current response has been sent.
+        return;
+    }
+
+    const HttpServerConfig* config = m_config->get();
+
     // The loop adds support for HTTP pipelinig
     while ( m_socket->bytesAvailable() ) {
 #ifdef SUPERVERBOSE
@@ -150,7 +238,8 @@ void HttpConnectionHandler::read() {
 
         // Create new HttpRequest object if necessary
         if ( !m_currentRequest ) {
-            m_currentRequest = new HttpRequest( m_settings );
+            m_currentRequest = new HttpRequest( config );
+            m_currentRequest->setRequestHandler( m_requestHandler );
         }
 
         // Collect data for the request object
@@ -159,15 +248,15 @@ void HttpConnectionHandler::read() {
             if ( m_currentRequest->getStatus() == HttpRequest::WAIT_FOR_BODY ) {
                 // Restart timer for read timeout, otherwise it would
                 // expire during large file uploads.
-                int readTimeout = m_settings->value( "readTimeout", 10000 ).toInt();
-                m_readTimer.start( readTimeout );
+                m_readTimer.start( config->readTimeout );
             }
         }
 
         // If the request is aborted, return error message and close the connection
         if ( m_currentRequest->getStatus() == HttpRequest::ABORT ) {
-            m_socket->write( "HTTP/1.1 413 entity too large\r\nConnection: close\r\n\r\n413 Entity too large\r\n" );
-            while ( m_socket->bytesToWrite() ) m_socket->waitForBytesWritten();
+            QByteArray status = QByteArray::number( m_currentRequest->getAbortStatusCode() ) + " "
+                                + m_currentRequest->getAbortStatusText();
+            m_socket->write( "HTTP/1.1 " + status + "\r\nConnection: close\r\n\r\n" + status + "\r\n" );
             m_socket->disconnectFromHost();
             delete m_currentRequest;
             m_currentRequest=nullptr;
@@ -179,69 +268,119 @@ void HttpConnectionHandler::read() {
             m_readTimer.stop();
             qDebug( "HttpConnectionHandler (%p): received request", static_cast<void*>( this ) );
 
-            // Copy the Connection:close header to the response
-            HttpResponse response( m_socket );
-            bool closeConnection = QString::compare( m_currentRequest->getHeader( "Connection" ), "close", Qt::CaseInsensitive ) == 0;
-            if ( closeConnection ) {
-                response.setHeader( "Connection", "close" );
-            } else {
-                // In case of HTTP 1.0 protocol add the Connection:close header.
-                // This ensures that the HttpResponse does not activate chunked mode, which is not spported by HTTP 1.0.
-                bool http1_0 = QString::compare( m_currentRequest->getVersion(), "HTTP/1.0", Qt::CaseInsensitive ) == 0;
-                if ( http1_0 ) {
-                    closeConnection = true;
-                    response.setHeader( "Connection", "close" );
-                }
+            if ( m_workerPool ) {
+                // Reactor mode: release the socket and let the worker pool call the request handler
+                m_inService = true;
+                m_socket->moveToThread( nullptr );
+                m_workerPool->start( new HttpServiceTask( this ) );
+                return;
             }
 
-            // Call the request mapper
-            try{
-                m_requestHandler->service( *m_currentRequest, response );
-
-            } catch ( ... ) {
-                qCritical( "HttpConnectionHandler (%p): An uncatched exception occured in the request handler",
-                           static_cast<void*>( this ) );
+            finishRequest( serviceRequest() );
+            if ( m_currentResponse ) {
+                // The rest of the response is sent by bytesWritten()
+                return;
             }
+        }
+    }
+}
 
-            // Finalize sending the response if not already done
-            if ( !response.hasSentLastPart() ) {
-                response.write( QByteArray(), true );
-            }
+void HttpConnectionHandler::serviceFinished( bool closeConnection ) {
+    m_inService = false;
+    if ( m_socket->state() != QAbstractSocket::ConnectedState ) {
+        delete m_currentRequest;
+        m_currentRequest = nullptr;
+        disconnected();
+        return;
+    }
+    finishRequest( closeConnection );
+    // Process pipelined requests that arrived while the worker was busy
+    read();
+}
+
+bool HttpConnectionHandler::serviceRequest() {
+    // Copy the Connection:close header to the response
+    m_currentResponse = new HttpResponse( m_socket, m_config->get() );
+    HttpResponse& response = *m_currentResponse;
+    // Only a shared event-loop thread must not wait for the client, it serves other connections too
+    response.setBlocking( m_workerPool || m_ownsThread );
+    bool closeConnection = QString::compare( m_currentRequest->getHeader( "Connection" ), "close", Qt::CaseInsensitive ) == 0;
+    if ( closeConnection ) {
+        response.setHeader( "Connection", "close" );
+    } else {
+        // In case of HTTP 1.0 protocol add the Connection:close header.
+        // This ensures that the HttpResponse does not activate chunked mode, which is not spported by HTTP 1.0.
+        bool http1_0 = QString::compare( m_currentRequest->getVersion(), "HTTP/1.0", Qt::CaseInsensitive ) == 0;
+        if ( http1_0 ) {
+            closeConnection = true;
+            response.setHeader( "Connection", "close" );
+        }
+    }
+
+    // Compress the response if the client supports it
+    if ( m_config->get()->compressMinSize > 0 ) {
+        response.setCompression( HttpCompressor::negotiate( m_currentRequest->getHeader( "Accept-Encoding" ) ) );
+    }
+
+    // Call the request mapper
+    try{
+        m_requestHandler->service( *m_currentRequest, response );
+
+    } catch ( ... ) {
+        qCritical( "HttpConnectionHandler (%p): An uncatched exception occured in the request handler",
+                   static_cast<void*>( this ) );
+    }
+
+    // Finalize sending the response if not already done
+    if ( !response.hasSentLastPart() ) {
+        response.write( QByteArray(), true );
+    }
 
 #ifdef SUPERVERBOSE
-            qDebug( "HttpConnectionHandler (%p): finished request", static_cast<void*>( this ) );
+    qDebug( "HttpConnectionHandler (%p): finished request", static_cast<void*>( this ) );
 #endif
 
-            // Find out whether the connection must be closed
-            if ( !closeConnection ) {
-                // Maybe the request handler or mapper added a Connection:close header in the meantime
-                bool closeResponse = QString::compare( response.getHeaders().value( "Connection" ), "close", Qt::CaseInsensitive ) == 0;
-                if ( closeResponse == true ) {
+    // Find out whether the connection must be closed
+    if ( !closeConnection ) {
+        // Maybe the request handler or mapper added a Connection:close header in the meantime
+        bool closeResponse = QString::compare( response.getHeaders().value( "Connection" ), "close", Qt::CaseInsensitive ) == 0;
+        if ( closeResponse == true ) {
+            closeConnection = true;
+        } else {
+            // If we have no Content-Length header and did not use chunked mode, then we have to close the
+            // connection to tell the HTTP client that the end of the response has been reached.
+            bool hasContentLength = response.getHeaders().contains( "Content-Length" );
+            bool hasBody = response.getStatusCode() != 204 && response.getStatusCode() != 304;
+            if ( !hasContentLength && hasBody ) {
+                bool hasChunkedMode = QString::compare( response.getHeaders().value( "Transfer-Encoding" ), "chunked", Qt::CaseInsensitive ) == 0;
+                if ( !hasChunkedMode ) {
                     closeConnection = true;
-                } else {
-                    // If we have no Content-Length header and did not use chunked mode, then we have to close the
-                    // connection to tell the HTTP client that the end of the response has been reached.
-                    bool hasContentLength = response.getHeaders().contains( "Content-Length" );
-                    if ( !hasContentLength ) {
-                        bool hasChunkedMode = QString::compare( response.getHeaders().value( "Transfer-Encoding" ), "chunked", Qt::CaseInsensitive ) == 0;
-                        if ( !hasChunkedMode ) {
-                            closeConnection = true;
-                        }
-                    }
                 }
             }
-
-            // Close the connection or prepare for the next request on the same connection.
-            if ( closeConnection ) {
-                while ( m_socket->bytesToWrite() ) m_socket->waitForBytesWritten();
-                m_socket->disconnectFromHost();
-            } else {
-                // Start timer for next request
-                int readTimeout = m_settings->value( "readTimeout", 10000 ).toInt();
-                m_readTimer.start( readTimeout );
-            }
-            delete m_currentRequest;
-            m_currentRequest = nullptr;
         }
     }
+    return closeConnection;
+}
+
+void HttpConnectionHandler::finishRequest( bool closeConnection ) {
+    if ( m_currentResponse && m_currentResponse->hasPendingOutput() ) {
+        // The client is slower than the request handler, continue when the socket has written some bytes.
+        // Meanwhile the timer detects clients that stopped receiving.
+        m_closeAfterResponse = closeConnection;
+        m_readTimer.start( m_config->get()->readTimeout );
+        return;
+    }
+    delete m_currentResponse;
+    m_currentResponse = nullptr;
+
+    // Close the connection or prepare for the next request on the same connection.
+    if ( closeConnection ) {
+        // Pending bytes of the output buffer are sent before the connection gets closed
+        m_socket->disconnectFromHost();
+    } else {
+        // Start timer for next request
+        m_readTimer.start( m_config->get()->readTimeout );
+    }
+    delete m_currentRequest;
+    m_currentRequest = nullptr;
 }
@@ -13,9 +13,13 @@
 #include <QSettings>
 #include <QTimer>
 #include <QThread>
+#include <QThreadPool>
+#include <QAtomicInt>
 #include "httpglobal.h"
 #include "httprequest.h"
 #include "httprequesthandler.h"
+#include "httpresponse.h"
+#include "httpserverconfig.h"
 
 namespace stefanfrings {
 
@@ -41,9 +45,34 @@ typedef int tSocketDescriptor;
    readTimeout=60000
    maxRequestSize=16000
    maxMultiPartSize=1000000
+   writeHighWatermark=65536
+   writeLowWatermark=16384
+   compressMinSize=1024
+   compressLevel=6
    </pre></code>
    <p>
    The readTimeout value defines the maximum time to wait for a complete HTTP request.
+   It also limits the time that a client may not receive any bytes of a response.
+   <p>
+   Responses are sent without blocking the thread, except for request handlers that stream
+   a body with many calls to HttpResponse::write() (see HttpResponse::setBlocking()).
+   If the client receives slower than the response is generated, the HttpResponse keeps the
+   rest as pending output. The handler
+   passes it to the socket whenever the output buffer drained below writeLowWatermark bytes,
+   until the buffer holds writeHighWatermark bytes again. Meanwhile pipelined requests wait.
+   <p>
+   If compressMinSize is greater than 0 and the library has been built with zlib, responses
+   are compressed with gzip or deflate as negotiated by the Accept-Encoding header of the request.
+   Only bodies of compressible content types (e.g. text, JSON, JavaScript) are compressed, and only
+   if they are at least compressMinSize bytes large or streamed with multiple calls to write().
+   Request handlers that set a Content-Encoding header themselves are not affected.
+   The compressLevel ranges from 1 (fast) to 9 (small), the default is 6.
+   <p>
+   By default each handler owns a thread that serves exactly one connection at a time.
+   In reactor mode (see HttpConnectionHandlerPool) the handler lives in a shared event-loop
+   thread together with many other handlers, and the request handler is executed by a
+   separate worker pool. While a request is being serviced, the socket is temporarily
+   moved to the worker thread and returned to the event-loop thread afterwards.
    @see HttpRequest for description of config settings maxRequestSize and maxMultiPartSize.
  */
 class DECLSPEC HttpConnectionHandler : public QObject {
@@ -53,21 +82,36 @@ class DECLSPEC HttpConnectionHandler : public QObject {
 public:
     /**
        Constructor.
-       @param settings Configuration settings of the HTTP webserver
+       @param config Configuration of the HTTP webserver
        @param requestHandler Handler that will process each incoming HTTP request
        @param sslConfiguration SSL (HTTPS) will be used if not NULL
+       @param reactorThread Shared event-loop thread to live in. If NULL, the handler starts its own thread.
+       @param workerPool Pool that executes the request handler in reactor mode. If NULL, requests are
+       processed by the thread of this handler.
      */
-    HttpConnectionHandler( const QSettings* settings, HttpRequestHandler* requestHandler,
-                           const QSslConfiguration* sslConfiguration = nullptr );
+    HttpConnectionHandler( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler,
+                           const QSslConfiguration* sslConfiguration = nullptr,
+                           QThread* reactorThread = nullptr, QThreadPool* workerPool = nullptr );
 
     /** Destructor */
     virtual ~HttpConnectionHandler();
 
-    /** Returns true, if this handler is in use. */
-    bool isBusy();
+    /** Returns true, if this handler is in use. This method is thread safe. */
+    bool isBusy() const;
+
+    /**
+       Mark this handler as busy. This method is thread safe.
+       @return false if the handler was already busy
+     */
+    bool setBusy();
 
-    /** Mark this handler as busy */
-    void setBusy();
+signals:
+    /**
+       Emitted in the thread of the handler, when the connection has been closed and the
+       handler can serve the next connection.
+       @param handler This handler
+     */
+    void released( stefanfrings::HttpConnectionHandler* handler );
 
 public slots:
     /**
@@ -77,8 +121,8 @@ public slots:
     void handleConnection( const stefanfrings::tSocketDescriptor socketDescriptor );
 
 private:
-    /** Configuration settings */
-    const QSettings* m_settings;
+    /** Configuration of the HTTP webserver */
+    const HttpServerConfigHolder* m_config;
 
     /** TCP socket of the current connection  */
     QTcpSocket* m_socket;
@@ -86,17 +130,32 @@ private:
     /** The thread that processes events of this connection */
     QThread* m_thread;
 
+    /** Whether m_thread has been started by this handler, false in reactor mode */
+    bool m_ownsThread;
+
+    /** Executes the request handler in reactor mode, NULL otherwise */
+    QThreadPool* m_workerPool;
+
+    /** True while the current request is being processed by the worker pool */
+    bool m_inService;
+
     /** Time for read timeout detection */
     QTimer m_readTimer;
 
     /** Storage for the current incoming HTTP request */
     HttpRequest* m_currentRequest;
 
+    /** Response of the current request, while it has pending output */
+    HttpResponse* m_currentResponse;
+
+    /** Whether the connection must be closed after the pending output has been sent */
+    bool m_closeAfterResponse;
+
     /** Dispatches received requests to services */
     HttpRequestHandler* m_requestHandler;
 
-    /** This shows the busy-state from a very early time */
-    bool m_busy;
+    /** This shows the busy-state from a very early time, 1=busy, 0=idle */
+    QAtomicInt m_busy;
 
     /** Configuration for SSL */
     const QSslConfiguration* m_sslConfiguration;
@@ -104,6 +163,23 @@ private:
     /**  Create SSL or TCP socket */
     void createSocket();
 
+    /** Mark this handler as idle and return it to the pool */
+    void setIdle();
+
+    /**
+       Pass the current request to the request handler and finalize the response.
+       @return true if the connection must be closed afterwards
+     */
+    bool serviceRequest();
+
+    /**
+       Close the connection or prepare for the next request on the same connection.
+       If the response has pending output, this is deferred until it has been sent.
+     */
+    void finishRequest( const bool closeConnection );
+
+    friend class HttpServiceTask;
+
 private slots:
 
     /** Received from the socket when a read-timeout occured */
@@ -115,8 +191,14 @@ private slots:
     /** Received from the socket when a connection has been closed */
     void disconnected();
 
+    /** Received from the socket when bytes have been written, sends pending output */
+    void bytesWritten();
+
     /** Cleanup after the thread is closed */
     void thread_done();
+
+    /** Received from the worker pool when the current request has been processed (reactor mode) */
+    void serviceFinished( const bool closeConnection );
 };
 
 } // end of namespace
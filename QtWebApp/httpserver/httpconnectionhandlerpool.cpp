@@ -9,22 +9,51 @@
 
 using namespace stefanfrings;
 
-HttpConnectionHandlerPool::HttpConnectionHandlerPool( const QSettings* settings, HttpRequestHandler* requestHandler ) :
+HttpConnectionHandlerPool::HttpConnectionHandlerPool( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler ) :
     QObject(),
-    m_settings( settings ),
+    m_config( config ),
     m_requestHandler( requestHandler ),
+    m_nextReactorThread( 0 ),
+    m_workerPool( nullptr ),
     m_sslConfiguration( nullptr ) {
 
-    Q_ASSERT( settings!=0 );
+    Q_ASSERT( config!=0 );
     loadSslConfig();
 
-    m_cleanupTimer.start( settings->value( "cleanupInterval", 1000 ).toInt() );
+    int reactorThreads = config->get()->reactorThreads;
+    if ( reactorThreads > 0 ) {
+        for ( int i = 0; i < reactorThreads; ++i ) {
+            QThread* thread = new QThread;
+            thread->start();
+            m_reactorThreads.append( thread );
+        }
+        m_workerPool = new QThreadPool;
+        m_workerPool->setMaxThreadCount( config->get()->maxThreads );
+        qDebug( "HttpConnectionHandlerPool: reactor mode with %i event-loop threads", reactorThreads );
+    }
+
+    m_cleanupTimer.start( config->get()->cleanupInterval );
     connect( &m_cleanupTimer, &QTimer::timeout, this, &HttpConnectionHandlerPool::cleanup );
 }
 
 HttpConnectionHandlerPool::~HttpConnectionHandlerPool() {
+    if ( m_workerPool ) {
+        // Let running requests finish, then stop the event-loop threads before the handlers get deleted
+        m_workerPool->waitForDone();
+        for ( QThread* thread : qAsConst( m_reactorThreads ) ) {
+            thread->quit();
+            thread->wait();
+        }
+    }
     // delete all connection handlers and wait until their threads are closed
-    qDeleteAll( m_pool );
+    m_mutex.lock();
+    QSet<HttpConnectionHandler*> handlers = m_pool;
+    m_pool.clear();
+    m_idle.clear();
+    m_mutex.unlock();
+    qDeleteAll( handlers );
+    qDeleteAll( m_reactorThreads );
+    delete m_workerPool;
     delete m_sslConfiguration;
 #ifdef SUPERVERBOSE
     qDebug( "HttpConnectionHandlerPool (%p): destroyed", this );
@@ -34,67 +63,85 @@ HttpConnectionHandlerPool::~HttpConnectionHandlerPool() {
 HttpConnectionHandler* HttpConnectionHandlerPool::getConnectionHandler() {
     HttpConnectionHandler* freeHandler = nullptr;
     m_mutex.lock();
-    // find a free handler in pool
-    for ( HttpConnectionHandler* handler : qAsConst( m_pool ) ) {
-        if ( !handler->isBusy() ) {
-            freeHandler = handler;
-            freeHandler->setBusy();
-            break;
-        }
-    }
-
-    // create a new handler, if necessary
-    if ( !freeHandler ) {
-        int maxConnectionHandlers = m_settings->value( "maxThreads", 100 ).toInt();
+    // take the most recently released handler from the idle stack
+    if ( !m_idle.isEmpty() ) {
+        freeHandler = m_idle.takeLast();
+        bool reserved = freeHandler->setBusy();
+        Q_ASSERT( reserved ); // handlers on the idle stack are never busy
+        Q_UNUSED( reserved )
+    } else {
+        // create a new handler, if necessary
+        const HttpServerConfig* config = m_config->get();
+        int maxConnectionHandlers = m_workerPool ? config->maxConnections : config->maxThreads;
         if ( m_pool.count() < maxConnectionHandlers ) {
-            freeHandler = new HttpConnectionHandler( m_settings, m_requestHandler, m_sslConfiguration );
+            QThread* reactorThread = nullptr;
+            if ( !m_reactorThreads.isEmpty() ) {
+                // Spread the connections evenly over the event-loop threads
+                reactorThread = m_reactorThreads.at( m_nextReactorThread );
+                m_nextReactorThread = ( m_nextReactorThread + 1 ) % m_reactorThreads.count();
+            }
+            freeHandler = new HttpConnectionHandler( m_config, m_requestHandler, m_sslConfiguration, reactorThread, m_workerPool );
             freeHandler->setBusy();
-            m_pool.append( freeHandler );
+            connect( freeHandler, &HttpConnectionHandler::released, this, &HttpConnectionHandlerPool::release, Qt::DirectConnection );
+            m_pool.insert( freeHandler );
         }
     }
     m_mutex.unlock();
     return freeHandler;
 }
 
+void HttpConnectionHandlerPool::release( HttpConnectionHandler* handler ) {
+    m_mutex.lock();
+    if ( m_pool.contains( handler ) ) {
+        m_idle.append( handler );
+    }
+    m_mutex.unlock();
+}
+
 void HttpConnectionHandlerPool::cleanup() {
-    int maxIdleHandlers = m_settings->value( "minThreads", 1 ).toInt();
-    int idleCounter = 0;
+    int maxIdleHandlers = m_config->get()->minThreads;
+    HttpConnectionHandler* handler = nullptr;
     m_mutex.lock();
-    for ( HttpConnectionHandler* handler : qAsConst( m_pool ) ) {
-        if ( !handler->isBusy() ) {
-            if ( ++idleCounter > maxIdleHandlers ) {
-                delete handler;
-                m_pool.removeOne( handler );
+    if ( m_idle.count() > maxIdleHandlers ) {
+        // remove only one handler in each interval, the one that has been idle for the longest time
+        handler = m_idle.takeFirst();
+        m_pool.remove( handler );
+    }
+    m_mutex.unlock();
+    if ( handler ) {
+        if ( m_workerPool ) {
+            // The handler lives in a running event-loop thread
+            handler->deleteLater();
+        } else {
+            delete handler;
+        }
 #ifdef SUPERVERBOSE
-                long int poolSize = (long int)m_pool.size();
-                qDebug( "HttpConnectionHandlerPool: Removed connection handler (%p), pool size is now %li", handler, poolSize );
+        long int poolSize = (long int)m_pool.size();
+        qDebug( "HttpConnectionHandlerPool: Removed connection handler (%p), pool size is now %li", handler, poolSize );
 #endif
-                break; // remove only one handler in each interval
-            }
-        }
     }
-    m_mutex.unlock();
 }
 
 void HttpConnectionHandlerPool::loadSslConfig() {
     // If certificate and key files are configured, then load them
-    QString sslKeyFileName = m_settings->value( "sslKeyFile", "" ).toString();
-    QString sslCertFileName = m_settings->value( "sslCertFile", "" ).toString();
+    const HttpServerConfig* config = m_config->get();
+    QString sslKeyFileName = config->sslKeyFile;
+    QString sslCertFileName = config->sslCertFile;
     if ( !sslKeyFileName.isEmpty() && !sslCertFileName.isEmpty() ) {
 #ifdef QT_NO_SSL
         qWarning( "HttpConnectionHandlerPool: SSL is not supported" );
 #else
         // Convert relative fileNames to absolute, based on the directory of the config file.
-        QFileInfo configFile( m_settings->fileName() );
+        QFileInfo configFile( config->fileName );
 #ifdef Q_OS_WIN32
-        if ( QDir::isRelativePath( sslKeyFileName ) && settings->format()!=QSettings::NativeFormat ) {
+        if ( QDir::isRelativePath( sslKeyFileName ) && !config->nativeFormat ) {
 #else
         if ( QDir::isRelativePath( sslKeyFileName ) ) {
 #endif // Q_OS_WIN32
             sslKeyFileName = QFileInfo( configFile.absolutePath(), sslKeyFileName ).absoluteFilePath();
         }
 #ifdef Q_OS_WIN32
-        if ( QDir::isRelativePath( sslCertFileName ) && settings->format()!=QSettings::NativeFormat ) {
+        if ( QDir::isRelativePath( sslCertFileName ) && !config->nativeFormat ) {
 #else
         if ( QDir::isRelativePath( sslCertFileName ) ) {
 #endif // Q_OS_WIN32
@@ -2,11 +2,15 @@
 #define HTTPCONNECTIONHANDLERPOOL_H
 
 #include <QList>
+#include <QSet>
 #include <QTimer>
 #include <QObject>
 #include <QMutex>
+#include <QThread>
+#include <QThreadPool>
 #include "httpglobal.h"
 #include "httpconnectionhandler.h"
+#include "httpserverconfig.h"
 
 namespace stefanfrings {
 
@@ -30,6 +34,21 @@ namespace stefanfrings {
    the number of idle threads slowly by closing one thread in each interval.
    But the configured minimum number of threads are kept running.
    <p>
+   Idle handlers are kept on a stack, so getting and returning a handler takes constant
+   time, independent of the size of the pool. The most recently used handler is reused first.
+   <p>
+   Optionally, the pool runs in reactor mode:
+   <code><pre>
+   reactorThreads=4
+   maxThreads=100
+   maxConnections=10000
+   </pre></code>
+   If reactorThreads is greater than 0, the connection handlers do not start own threads.
+   Instead, a fixed number of event-loop threads is started, and each of them multiplexes
+   many connections. The request handler is then executed by a worker pool with up to
+   maxThreads threads, so idle keep-alive connections do not occupy any thread. The number
+   of concurrent connections is limited by maxConnections instead of maxThreads.
+   <p>
    For SSL support, you need an OpenSSL certificate file and a key file.
    Both can be created with the command
    <code><pre>
@@ -52,11 +71,13 @@ class DECLSPEC HttpConnectionHandlerPool : public QObject {
 public:
     /**
        Constructor.
-       @param settings Configuration settings for the HTTP server. Must not be 0.
+       @param config Configuration of the HTTP server. Must not be 0.
+       The settings for reactor mode, SSL and the cleanup interval are taken from the
+       snapshot that is current at construction time, all other settings are re-read on use.
        @param requestHandler The handler that will process each received HTTP request.
        @warning The requestMapper gets deleted by the destructor of this pool
      */
-    HttpConnectionHandlerPool( const QSettings* settings, HttpRequestHandler* requestHandler );
+    HttpConnectionHandlerPool( const HttpServerConfigHolder* config, HttpRequestHandler* requestHandler );
 
     /** Destructor */
     virtual ~HttpConnectionHandlerPool();
@@ -65,14 +86,26 @@ public:
     HttpConnectionHandler* getConnectionHandler();
 
 private:
-    /** Settings for this pool */
-    const QSettings* m_settings;
+    /** Configuration of the HTTP server */
+    const HttpServerConfigHolder* m_config;
 
     /** Will be assigned to each Connectionhandler during their creation */
     HttpRequestHandler* m_requestHandler;
 
-    /** Pool of connection handlers */
-    QList<HttpConnectionHandler*> m_pool;
+    /** Pool of connection handlers, busy and idle ones */
+    QSet<HttpConnectionHandler*> m_pool;
+
+    /** Stack of idle connection handlers, the top is the most recently released one */
+    QList<HttpConnectionHandler*> m_idle;
+
+    /** Shared event-loop threads in reactor mode, empty otherwise */
+    QList<QThread*> m_reactorThreads;
+
+    /** Index of the reactor thread that receives the next new connection handler */
+    int m_nextReactorThread;
+
+    /** Executes the request handler in reactor mode, NULL otherwise */
+    QThreadPool* m_workerPool;
 
     /** Timer to clean-up unused connection handler */
     QTimer m_cleanupTimer;
@@ -90,6 +123,9 @@ private slots:
     /** Received from the clean-up timer.  */
     void cleanup();
 
+    /** Received from a connection handler when it becomes idle. Executed in the thread of the handler. */
+    void release( stefanfrings::HttpConnectionHandler* handler );
+
 };
 
 } // end of namespace
@@ -0,0 +1,136 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpheaderscanner.h"
+#include <QtAlgorithms>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define HTTPHEADERSCANNER_SSE2
+    #include <emmintrin.h>
+#endif
+#if defined( HTTPHEADERSCANNER_SSE2 ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+    // AVX2 is compiled for this function only and selected at runtime
+    #define HTTPHEADERSCANNER_AVX2
+    #include <immintrin.h>
+#endif
+
+using namespace stefanfrings;
+
+namespace {
+
+/**
+   Evaluate a bit mask of line feeds and colons, where bit n belongs to data[base+n].
+   @return false if the capacity of lines is exhausted
+ */
+inline bool collect( const char* data, int base, quint32 mask, int& colon,
+                     HttpHeaderLine* lines, int& count, const int maxLines ) {
+    while ( mask ) {
+        int pos = base + int( qCountTrailingZeroBits( mask ) );
+        mask &= mask - 1;
+        if ( data[pos] == '\n' ) {
+            lines[count].end = pos;
+            lines[count].colon = colon;
+            if ( ++count == maxLines ) {
+                return false;
+            }
+            colon = -1;
+        } else if ( colon < 0 ) {
+            colon = pos;
+        }
+    }
+    return true;
+}
+
+#ifdef HTTPHEADERSCANNER_AVX2
+__attribute__( ( target( "avx2" ) ) )
+int scanAvx2( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines ) {
+    int count = 0;
+    int colon = -1;
+    int pos = from;
+    const __m256i newLine = _mm256_set1_epi8( '\n' );
+    const __m256i colonChar = _mm256_set1_epi8( ':' );
+    for ( ; pos + 32 <= to; pos += 32 ) {
+        __m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( data + pos ) );
+        quint32 mask = quint32( _mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( block, newLine ),
+                                                                        _mm256_cmpeq_epi8( block, colonChar ) ) ) );
+        if ( !collect( data, pos, mask, colon, lines, count, maxLines ) ) {
+            return count;
+        }
+    }
+    for ( ; pos < to; ++pos ) {
+        if ( data[pos] == '\n' || data[pos] == ':' ) {
+            if ( !collect( data, pos, 1, colon, lines, count, maxLines ) ) {
+                return count;
+            }
+        }
+    }
+    return count;
+}
+
+bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports( "avx2" );
+    return supported;
+}
+#endif
+
+#ifdef HTTPHEADERSCANNER_SSE2
+int scanSse2( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines ) {
+    int count = 0;
+    int colon = -1;
+    int pos = from;
+    const __m128i newLine = _mm_set1_epi8( '\n' );
+    const __m128i colonChar = _mm_set1_epi8( ':' );
+    for ( ; pos + 16 <= to; pos += 16 ) {
+        __m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + pos ) );
+        quint32 mask = quint32( _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( block, newLine ),
+                                                                 _mm_cmpeq_epi8( block, colonChar ) ) ) );
+        if ( !collect( data, pos, mask, colon, lines, count, maxLines ) ) {
+            return count;
+        }
+    }
+    for ( ; pos < to; ++pos ) {
+        if ( data[pos] == '\n' || data[pos] == ':' ) {
+            if ( !collect( data, pos, 1, colon, lines, count, maxLines ) ) {
+                return count;
+            }
+        }
+    }
+    return count;
+}
+#endif
+
+} // end of anonymous namespace
+
+int HttpHeaderScanner::scan( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines ) {
+    if ( maxLines <= 0 ) {
+        return 0;
+    }
+#ifdef HTTPHEADERSCANNER_AVX2
+    if ( hasAvx2() ) {
+        return scanAvx2( data, from, to, lines, maxLines );
+    }
+#endif
+#ifdef HTTPHEADERSCANNER_SSE2
+    return scanSse2( data, from, to, lines, maxLines );
+#else
+    return scanScalar( data, from, to, lines, maxLines );
+#endif
+}
+
+int HttpHeaderScanner::scanScalar( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines ) {
+    int count = 0;
+    int colon = -1;
+    for ( int pos = from; pos < to && count < maxLines; ++pos ) {
+        if ( data[pos] == '\n' ) {
+            lines[count].end = pos;
+            lines[count].colon = colon;
+            ++count;
+            colon = -1;
+        } else if ( data[pos] == ':' && colon < 0 ) {
+            colon = pos;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,51 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPHEADERSCANNER_H
+#define HTTPHEADERSCANNER_H
+
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/** Position of a complete line, found by HttpHeaderScanner */
+struct HttpHeaderLine {
+    /** Position of the terminating line feed */
+    int end;
+    /** Position of the first colon within the line, or -1 if there is none */
+    int colon;
+};
+
+/**
+   Finds the line boundaries and colons of HTTP headers in a single pass over a
+   block of received bytes.
+   <p>
+   On x86 processors the block is compared 16 bytes at a time with SSE2, or
+   32 bytes at a time with AVX2 if the CPU supports it. On other processors a
+   scalar loop is used. The scanner does not allocate memory.
+ */
+
+class DECLSPEC HttpHeaderScanner {
+    friend class HttpHeaderScannerBenchmark;
+public:
+    /**
+       Find complete lines in data[from..to).
+       @param data The received bytes
+       @param from Position of the first byte to scan, must be the beginning of a line
+       @param to Position after the last byte to scan
+       @param lines Receives the positions of the lines that were found
+       @param maxLines Capacity of lines, scanning stops when it is reached
+       @return Number of lines found. Bytes after the last line are an incomplete line.
+     */
+    static int scan( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines );
+
+private:
+    /** Implementation of scan() for processors without SSE2 */
+    static int scanScalar( const char* data, const int from, const int to, HttpHeaderLine* lines, const int maxLines );
+};
+
+} // end of namespace
+
+#endif // HTTPHEADERSCANNER_H
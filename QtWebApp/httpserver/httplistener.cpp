@@ -7,12 +7,35 @@
 #include "httpconnectionhandler.h"
 #include "httpconnectionhandlerpool.h"
 #include <QCoreApplication>
+#include <QRunnable>
+
+namespace stefanfrings {
+
+/**
+   Calls HttpRequestHandler::warmUp() in background mode.
+ */
+class HttpWarmUpTask : public QRunnable {
+public:
+    explicit HttpWarmUpTask( HttpRequestHandler* requestHandler ) :
+        m_requestHandler( requestHandler ) {}
+
+    void run() override {
+        m_requestHandler->warmUp();
+        qDebug( "HttpListener: caches are warm" );
+    }
+
+private:
+    HttpRequestHandler* m_requestHandler;
+};
+
+} // end of namespace
 
 using namespace stefanfrings;
 
 HttpListener::HttpListener( const QSettings* settings, HttpRequestHandler* requestHandler, QObject* parent ) :
     QTcpServer( parent ),
     m_settings( settings ),
+    m_config( new HttpServerConfigHolder( settings ) ),
     m_requestHandler( requestHandler ),
     m_pool( nullptr ) {
 
@@ -20,23 +43,63 @@ HttpListener::HttpListener( const QSettings* settings, HttpRequestHandler* reque
     Q_ASSERT( requestHandler != nullptr );
     // Reqister type of socketDescriptor for signal/slot handling
     qRegisterMetaType<stefanfrings::tSocketDescriptor>( "stefanfrings::tSocketDescriptor" );
+    // Fill the caches of the request handler
+    const QString& warmUp = m_config->get()->warmUp;
+    if ( warmUp == "blocking" ) {
+        qDebug( "HttpListener: warming up caches" );
+        m_requestHandler->warmUp();
+    } else if ( warmUp == "background" ) {
+        qDebug( "HttpListener: warming up caches in background" );
+        m_warmUpPool.setMaxThreadCount( 1 );
+        m_warmUpPool.start( new HttpWarmUpTask( m_requestHandler ) );
+    } else if ( warmUp != "none" ) {
+        qWarning( "HttpListener: unknown warmUp mode %s", qPrintable( warmUp ) );
+    }
     // Start listening
     listen();
 }
 
 HttpListener::~HttpListener() {
     close();
+    // The request handler must not be deleted while it is warming up
+    m_warmUpPool.waitForDone();
+    delete m_config;
 #ifdef SUPERVERBOSE
     qDebug( "HttpListener: destroyed" );
 #endif
 }
 
 void HttpListener::listen() {
+    const HttpServerConfig* config = m_config->get();
+    const QString& host = config->host;
+    quint16 port = config->port;
+    int acceptThreads = config->acceptThreads;
+    if ( acceptThreads > 0 && !HttpAcceptor::isSupported() ) {
+        qWarning( "HttpListener: SO_REUSEPORT is not supported, using a single accept loop" );
+        acceptThreads = 0;
+    }
+    if ( acceptThreads > 0 ) {
+        if ( !m_acceptors.isEmpty() ) {
+            return;
+        }
+        for ( int i = 0; i < acceptThreads; ++i ) {
+            HttpAcceptor* acceptor = new HttpAcceptor( m_config, m_requestHandler );
+            m_acceptors.append( acceptor );
+            bool started = false;
+            QMetaObject::invokeMethod( acceptor, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG( bool, started ) );
+            if ( !started ) {
+                qCritical( "HttpListener: Cannot bind on port %i with SO_REUSEPORT", port );
+                close();
+                return;
+            }
+        }
+        qDebug( "HttpListener: Listening on port %i with %i accept threads", port, acceptThreads );
+        return;
+    }
+
     if ( !m_pool ) {
-        m_pool = new HttpConnectionHandlerPool( m_settings, m_requestHandler );
+        m_pool = new HttpConnectionHandlerPool( m_config, m_requestHandler );
     }
-    QString host = m_settings->value( "host" ).toString();
-    quint16 port = m_settings->value( "port" ).toUInt() & 0xFFFF;
     QTcpServer::listen( host.isEmpty() ? QHostAddress::Any : QHostAddress( host ), port );
     if ( !isListening() ) {
         qCritical( "HttpListener: Cannot bind on port %i: %s", port, qPrintable( errorString() ) );
@@ -48,6 +111,11 @@ void HttpListener::listen() {
 
 void HttpListener::close() {
     QTcpServer::close();
+    for ( HttpAcceptor* acceptor : qAsConst( m_acceptors ) ) {
+        QMetaObject::invokeMethod( acceptor, "stop", Qt::BlockingQueuedConnection );
+        delete acceptor;
+    }
+    m_acceptors.clear();
     qDebug( "HttpListener: closed" );
     if ( m_pool ) {
         delete m_pool;
@@ -55,6 +123,10 @@ void HttpListener::close() {
     }
 }
 
+void HttpListener::reloadSettings() {
+    m_config->reload( m_settings );
+}
+
 void HttpListener::incomingConnection( tSocketDescriptor socketDescriptor ) {
 #ifdef SUPERVERBOSE
     qDebug( "HttpListener: New connection" );
@@ -9,10 +9,13 @@
 #include <QTcpServer>
 #include <QSettings>
 #include <QBasicTimer>
+#include <QThreadPool>
 #include "httpglobal.h"
 #include "httpconnectionhandler.h"
 #include "httpconnectionhandlerpool.h"
 #include "httprequesthandler.h"
+#include "httpacceptor.h"
+#include "httpserverconfig.h"
 
 namespace stefanfrings {
 
@@ -26,19 +29,40 @@ namespace stefanfrings {
    port=8080
    minThreads=1
    maxThreads=10
+   ;reactorThreads=4
+   ;maxConnections=10000
+   ;acceptThreads=4
    cleanupInterval=1000
    readTimeout=60000
    ;sslKeyFile=ssl/my.key
    ;sslCertFile=ssl/my.cert
    maxRequestSize=16000
    maxMultiPartSize=1000000
+   ;maxStreamedBodySize=100000000
+   ;writeHighWatermark=65536
+   ;writeLowWatermark=16384
+   ;compressMinSize=1024
+   ;compressLevel=6
+   ;warmUp=background
    </pre></code>
    The optional host parameter binds the listener to one network interface.
    The listener handles all network interfaces if no host is configured.
    The port number specifies the incoming TCP port that this listener listens to.
-   @see HttpConnectionHandlerPool for description of config settings minThreads, maxThreads, cleanupInterval and ssl settings
-   @see HttpConnectionHandler for description of the readTimeout
-   @see HttpRequest for description of config settings maxRequestSize and maxMultiPartSize
+   <p>
+   If acceptThreads is greater than 0 and the operating system supports SO_REUSEPORT,
+   the listener does not accept connections itself. Instead it starts the configured
+   number of HttpAcceptor threads, each with its own listening socket on the same port
+   and its own pool of connection handlers. The kernel then distributes incoming
+   connections over the acceptors. In this mode isListening() of the listener returns false.
+   <p>
+   The warmUp setting calls HttpRequestHandler::warmUp() at startup, so the first requests
+   after a deploy do not all miss the caches. With warmUp=blocking, the listener starts
+   listening after the caches are warm. With warmUp=background, it listens immediately and
+   the caches are filled by another thread on a best-effort basis. The default is none.
+   The progress is reported by the HttpRequestHandler::warmUpProgress() signal.
+   @see HttpConnectionHandlerPool for description of config settings minThreads, maxThreads, cleanupInterval, reactor mode and ssl settings
+   @see HttpConnectionHandler for description of the readTimeout, the write watermarks and compression
+   @see HttpRequest for description of config settings maxRequestSize, maxMultiPartSize and maxStreamedBodySize
  */
 
 class DECLSPEC HttpListener : public QTcpServer {
@@ -75,6 +99,13 @@ public:
      */
     void close();
 
+    /**
+       Parse the settings again and atomically replace the configuration of the server.
+       Changes of host, port, acceptThreads, reactor mode, SSL and cleanupInterval
+       take effect after the next close() and listen().
+     */
+    void reloadSettings();
+
 signals:
     /**
        Sent to the connection handler to process a new incoming connection.
@@ -91,11 +122,20 @@ private:
     /** Configuration settings for the HTTP server */
     const QSettings* m_settings;
 
+    /** Parsed configuration, shared with the connection handlers */
+    HttpServerConfigHolder* m_config;
+
     /** Point to the reuqest handler which processes all HTTP requests */
     HttpRequestHandler* m_requestHandler;
 
     /** Pool of connection handlers */
     HttpConnectionHandlerPool* m_pool;
+
+    /** Accept loops in multi-acceptor mode, empty otherwise */
+    QList<HttpAcceptor*> m_acceptors;
+
+    /** Runs HttpRequestHandler::warmUp() in background mode */
+    QThreadPool m_warmUpPool;
 };
 
 } // end of namespace
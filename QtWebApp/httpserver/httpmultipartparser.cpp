@@ -0,0 +1,221 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpmultipartparser.h"
+
+using namespace stefanfrings;
+
+HttpMultiPartParser::HttpMultiPartParser( const QByteArray& boundary, const int maxHeaderSize,
+                                          QMultiMap<QByteArray, QByteArray>* parameters,
+                                          QMap<QByteArray, QTemporaryFile*>* uploadedFiles ) :
+    m_state( PREAMBLE ),
+    m_delimiter( "\r\n--" + boundary ),
+    m_maxHeaderSize( maxHeaderSize ),
+    m_headerSize( 0 ),
+    m_parameters( parameters ),
+    m_uploadedFiles( uploadedFiles ),
+    m_sink( nullptr ),
+    m_file( nullptr ),
+    m_sinkActive( false ) {
+    m_matcher.setPattern( m_delimiter );
+    // The first boundary is not preceded by a line break, so pretend that there was one
+    m_buffer = "\r\n";
+}
+
+HttpMultiPartParser::~HttpMultiPartParser() {
+    if ( m_sinkActive ) {
+        m_sink->endFile( false );
+    }
+    delete m_file;
+}
+
+void HttpMultiPartParser::setUploadSink( HttpUploadSink* sink ) {
+    m_sink = sink;
+}
+
+bool HttpMultiPartParser::isFinished() const {
+    return m_state == EPILOGUE;
+}
+
+bool HttpMultiPartParser::write( const char* data, const int size ) {
+    if ( m_state == EPILOGUE ) {
+        return true;
+    }
+    if ( m_state == FAILED ) {
+        return false;
+    }
+    m_buffer.append( data, size );
+    int pos = 0;
+    while ( m_state != EPILOGUE && m_state != FAILED ) {
+        if ( m_state == PREAMBLE || m_state == PART_DATA ) {
+            int found = m_matcher.indexIn( m_buffer, pos );
+            if ( found < 0 ) {
+                // Pass on everything except a possible beginning of the delimiter
+                int safe = m_buffer.size() - m_delimiter.size() + 1;
+                if ( safe > pos ) {
+                    if ( m_state == PART_DATA && !partData( m_buffer.constData() + pos, safe - pos ) ) {
+                        m_state = FAILED;
+                    }
+                    pos = safe;
+                }
+                break;
+            }
+            if ( m_state == PART_DATA ) {
+                if ( !partData( m_buffer.constData() + pos, found - pos ) ) {
+                    m_state = FAILED;
+                    break;
+                }
+                partEnd();
+            }
+            pos = found + m_delimiter.size();
+            m_state = BOUNDARY_LINE;
+
+        } else if ( m_state == BOUNDARY_LINE ) {
+            // The delimiter is followed by "--" after the last part, otherwise by a line break
+            if ( m_buffer.size() - pos >= 2 && m_buffer.at( pos ) == '-' && m_buffer.at( pos + 1 ) == '-' ) {
+#ifdef SUPERVERBOSE
+                qDebug( "HttpMultiPartParser: final boundary received" );
+#endif
+                m_state = EPILOGUE;
+                break;
+            }
+            int newLine = m_buffer.indexOf( '\n', pos );
+            if ( newLine < 0 ) {
+                if ( m_buffer.size() - pos > m_maxHeaderSize ) {
+                    qWarning( "HttpMultiPartParser: format error, boundary line too long" );
+                    m_state = FAILED;
+                }
+                break;
+            }
+            pos = newLine + 1;
+            m_headerSize = 0;
+            m_state = PART_HEADERS;
+
+        } else if ( m_state == PART_HEADERS ) {
+            int newLine = m_buffer.indexOf( '\n', pos );
+            if ( newLine < 0 ) {
+                if ( m_headerSize + m_buffer.size() - pos > m_maxHeaderSize ) {
+                    qWarning( "HttpMultiPartParser: part headers are too large" );
+                    m_state = FAILED;
+                }
+                break;
+            }
+            m_headerSize += newLine + 1 - pos;
+            if ( m_headerSize > m_maxHeaderSize ) {
+                qWarning( "HttpMultiPartParser: part headers are too large" );
+                m_state = FAILED;
+                break;
+            }
+            QByteArray line = m_buffer.mid( pos, newLine - pos ).trimmed();
+            pos = newLine + 1;
+            if ( !line.isEmpty() ) {
+                parsePartHeader( line );
+            } else if ( partBegin() ) {
+                // Empty line, the data of the part follows
+                m_state = PART_DATA;
+            } else {
+                m_state = FAILED;
+            }
+        }
+    }
+    if ( m_state == EPILOGUE || m_state == FAILED ) {
+        m_buffer.clear();
+    } else {
+        m_buffer.remove( 0, pos );
+    }
+    return m_state != FAILED;
+}
+
+void HttpMultiPartParser::parsePartHeader( const QByteArray& line ) {
+    if ( qstrnicmp( line.constData(), "Content-Disposition:", 20 ) == 0 ) {
+        if ( line.contains( "form-data" ) ) {
+            int start = line.indexOf( " name=\"" );
+            int end = line.indexOf( "\"", start + 7 );
+            if ( start >= 0 && end >= start ) {
+                m_fieldName = line.mid( start + 7, end - start - 7 );
+            }
+            start = line.indexOf( " filename=\"" );
+            end = line.indexOf( "\"", start + 11 );
+            if ( start >= 0 && end >= start ) {
+                m_fileName = line.mid( start + 11, end - start - 11 );
+            }
+#ifdef SUPERVERBOSE
+            qDebug( "HttpMultiPartParser: multipart field=%s, filename=%s", m_fieldName.data(), m_fileName.data() );
+#endif
+        } else {
+#ifdef SUPERVERBOSE
+            qDebug( "HttpMultiPartParser: ignoring unsupported content part %s", line.data() );
+#endif
+        }
+    } else if ( qstrnicmp( line.constData(), "Content-Type:", 13 ) == 0 ) {
+        m_contentType = line.mid( 13 ).trimmed();
+    }
+}
+
+bool HttpMultiPartParser::partBegin() {
+    if ( m_fieldName.isEmpty() || m_fileName.isEmpty() ) {
+        // A form field, or an unsupported part that is ignored
+        return true;
+    }
+    if ( m_sink && m_sink->beginFile( m_fieldName, m_fileName, m_contentType ) ) {
+        m_sinkActive = true;
+        return true;
+    }
+    m_file = new QTemporaryFile;
+    if ( !m_file->open() ) {
+        qCritical( "HttpMultiPartParser: cannot create temp file, %s", qPrintable( m_file->errorString() ) );
+        return false;
+    }
+    return true;
+}
+
+bool HttpMultiPartParser::partData( const char* data, const int size ) {
+    if ( size == 0 || m_fieldName.isEmpty() ) {
+        return true;
+    }
+    if ( m_sinkActive ) {
+        return m_sink->writeFile( data, size );
+    }
+    if ( m_file ) {
+        if ( m_file->write( data, size ) != size ) {
+            qCritical( "HttpMultiPartParser: error writing temp file, %s", qPrintable( m_file->errorString() ) );
+            return false;
+        }
+        return true;
+    }
+    // this is a form field
+    m_fieldValue.append( data, size );
+    return true;
+}
+
+void HttpMultiPartParser::partEnd() {
+    if ( !m_fieldName.isEmpty() ) {
+        if ( m_fileName.isEmpty() ) {
+            // last part was a form field
+            m_parameters->insert( m_fieldName, m_fieldValue );
+#ifdef SUPERVERBOSE
+            qDebug( "HttpMultiPartParser: set parameter %s=%s", m_fieldName.data(), m_fieldValue.data() );
+#endif
+        } else {
+            // last part was a file
+            if ( m_sinkActive ) {
+                m_sink->endFile( true );
+                m_sinkActive = false;
+            } else {
+                m_file->flush();
+                m_file->seek( 0 );
+                delete m_uploadedFiles->value( m_fieldName );
+                m_uploadedFiles->insert( m_fieldName, m_file );
+                m_file = nullptr;
+            }
+            m_parameters->insert( m_fieldName, m_fileName );
+            qDebug( "HttpMultiPartParser: set parameter %s=%s", m_fieldName.data(), m_fileName.data() );
+        }
+    }
+    m_fieldName.clear();
+    m_fileName.clear();
+    m_contentType.clear();
+    m_fieldValue.clear();
+}
@@ -0,0 +1,155 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPMULTIPARTPARSER_H
+#define HTTPMULTIPARTPARSER_H
+
+#include <QByteArray>
+#include <QByteArrayMatcher>
+#include <QMap>
+#include <QMultiMap>
+#include <QTemporaryFile>
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/**
+   Receives the content of uploaded files instead of a temporary file.
+   The sink is owned by the caller and must live until the request is deleted.
+   @see HttpRequest::setUploadSink()
+ */
+
+class DECLSPEC HttpUploadSink {
+public:
+    /** Destructor */
+    virtual ~HttpUploadSink() {}
+
+    /**
+       Called when a file part begins.
+       @param fieldName Name of the form field
+       @param fileName Original file name as provided by the web browser
+       @param contentType Content type of the file, may be empty
+       @return false if the file shall be stored in a temporary file instead
+     */
+    virtual bool beginFile( const QByteArray& fieldName, const QByteArray& fileName, const QByteArray& contentType ) = 0;
+
+    /**
+       Called for each received block of the file content.
+       @return false to abort the request
+     */
+    virtual bool writeFile( const char* data, const int size ) = 0;
+
+    /**
+       Called after the file has been received.
+       @param complete false if the request ended before the file was complete
+     */
+    virtual void endFile( const bool complete ) = 0;
+};
+
+/**
+   Parses a multipart/form-data body while it is being received.
+   <p>
+   The parser searches for the boundary in each received block. Form fields are
+   collected in memory, uploaded files are written directly into a temporary file
+   or passed to a HttpUploadSink. Only the few bytes that might be the beginning
+   of a boundary are held back until the next block arrives.
+ */
+
+class DECLSPEC HttpMultiPartParser {
+    Q_DISABLE_COPY( HttpMultiPartParser )
+public:
+
+    /**
+       Constructor.
+       @param boundary Boundary from the Content-Type header
+       @param maxHeaderSize Maximum size of the headers of a single part
+       @param parameters Receives the form fields and the names of uploaded files
+       @param uploadedFiles Receives the temporary files, key is the field name
+     */
+    HttpMultiPartParser( const QByteArray& boundary, const int maxHeaderSize,
+                         QMultiMap<QByteArray, QByteArray>* parameters,
+                         QMap<QByteArray, QTemporaryFile*>* uploadedFiles );
+
+    /** Destructor. Deletes the temporary file of an incomplete part. */
+    virtual ~HttpMultiPartParser();
+
+    /** Pass uploaded files to the given sink. Must be called before the first part begins. */
+    void setUploadSink( HttpUploadSink* sink );
+
+    /**
+       Parse the next block of the body.
+       @return false if the body is malformed or the content could not be stored
+     */
+    bool write( const char* data, const int size );
+
+    /** Whether the final boundary has been received */
+    bool isFinished() const;
+
+private:
+
+    /** States of the parser */
+    enum State {PREAMBLE, BOUNDARY_LINE, PART_HEADERS, PART_DATA, EPILOGUE, FAILED};
+
+    /** Current state */
+    State m_state;
+
+    /** Delimiter between the parts, which is CRLF followed by "--" and the boundary */
+    QByteArray m_delimiter;
+
+    /** Searches for m_delimiter */
+    QByteArrayMatcher m_matcher;
+
+    /** Received bytes, that have not been processed yet */
+    QByteArray m_buffer;
+
+    /** Maximum size of the headers of a single part */
+    int m_maxHeaderSize;
+
+    /** Size of the headers of the current part */
+    int m_headerSize;
+
+    /** Receives the form fields */
+    QMultiMap<QByteArray, QByteArray>* m_parameters;
+
+    /** Receives the temporary files */
+    QMap<QByteArray, QTemporaryFile*>* m_uploadedFiles;
+
+    /** Optional receiver of uploaded files */
+    HttpUploadSink* m_sink;
+
+    /** Field name of the current part */
+    QByteArray m_fieldName;
+
+    /** File name of the current part, empty if it is a form field */
+    QByteArray m_fileName;
+
+    /** Content type of the current part */
+    QByteArray m_contentType;
+
+    /** Value of the current form field */
+    QByteArray m_fieldValue;
+
+    /** Temporary file of the current part */
+    QTemporaryFile* m_file;
+
+    /** Whether the current part is passed to m_sink */
+    bool m_sinkActive;
+
+    /** Evaluate a header line of the current part */
+    void parsePartHeader( const QByteArray& line );
+
+    /** Called after the headers of a part have been received */
+    bool partBegin();
+
+    /** Called for each block of data of the current part */
+    bool partData( const char* data, const int size );
+
+    /** Called when the boundary after the current part has been received */
+    void partEnd();
+};
+
+} // end of namespace
+
+#endif // HTTPMULTIPARTPARSER_H
@@ -0,0 +1,100 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httprange.h"
+#include <algorithm>
+
+using namespace stefanfrings;
+
+qint64 HttpRange::length() const {
+    return last - first + 1;
+}
+
+QByteArray HttpRange::contentRange( const qint64 size ) const {
+    return "bytes " + QByteArray::number( first ) + "-" + QByteArray::number( last ) + "/" + QByteArray::number( size );
+}
+
+HttpRange::Result HttpRange::parse( const QByteArray& header, const qint64 size, QList<HttpRange>& ranges, const int maxRanges ) {
+    ranges.clear();
+    QByteArray value = header.trimmed();
+    if ( qstrnicmp( value.constData(), "bytes=", 6 ) != 0 ) {
+        // Other units are not supported
+        return NONE;
+    }
+    const QList<QByteArray> list = value.mid( 6 ).split( ',' );
+    if ( list.size() > maxRanges ) {
+#ifdef SUPERVERBOSE
+        qDebug( "HttpRange: ignoring %i ranges", list.size() );
+#endif
+        return NONE;
+    }
+    int count = 0;
+    for ( const QByteArray& item : list ) {
+        QByteArray spec = item.trimmed();
+        if ( spec.isEmpty() ) {
+            continue;
+        }
+        ++count;
+        int dash = spec.indexOf( '-' );
+        if ( dash < 0 ) {
+            return NONE;
+        }
+        bool ok = true;
+        HttpRange range;
+        if ( dash == 0 ) {
+            // Suffix range, the last n bytes
+            qint64 suffix = spec.mid( 1 ).toLongLong( &ok );
+            if ( !ok || suffix < 0 ) {
+                return NONE;
+            }
+            if ( suffix == 0 || size == 0 ) {
+                continue;
+            }
+            range.first = qMax<qint64>( 0, size - suffix );
+            range.last = size - 1;
+        } else {
+            range.first = spec.left( dash ).toLongLong( &ok );
+            if ( !ok || range.first < 0 ) {
+                return NONE;
+            }
+            if ( dash == spec.size() - 1 ) {
+                range.last = size - 1;
+            } else {
+                range.last = spec.mid( dash + 1 ).toLongLong( &ok );
+                if ( !ok || range.last < range.first ) {
+                    return NONE;
+                }
+                range.last = qMin( range.last, size - 1 );
+            }
+            if ( range.first >= size ) {
+                continue;
+            }
+        }
+        ranges.append( range );
+    }
+    if ( count == 0 ) {
+        return NONE;
+    }
+    if ( ranges.size() > 1 ) {
+        // Overlapping and adjacent ranges are merged, so a request like "bytes=0-,0-,0-"
+        // cannot make the server send the content many times (RFC 7233 section 6.1)
+        std::sort( ranges.begin(), ranges.end(), []( const HttpRange& a, const HttpRange& b ) {
+            return a.first < b.first;
+        } );
+        QList<HttpRange> merged;
+        merged.append( ranges.first() );
+        for ( int i = 1; i < ranges.size(); ++i ) {
+            const HttpRange& range = ranges.at( i );
+            HttpRange& previous = merged.last();
+            if ( range.first <= previous.last + 1 ) {
+                previous.last = qMax( previous.last, range.last );
+            } else {
+                merged.append( range );
+            }
+        }
+        ranges = merged;
+    }
+    return ranges.isEmpty() ? UNSATISFIABLE : SATISFIABLE;
+}
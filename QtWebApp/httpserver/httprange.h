@@ -0,0 +1,59 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPRANGE_H
+#define HTTPRANGE_H
+
+#include <QByteArray>
+#include <QList>
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/**
+   A range of bytes requested by the Range header of a HTTP request.
+   @see HttpResponse::writeRanges()
+ */
+
+struct DECLSPEC HttpRange {
+
+    /** Result of parse() */
+    enum Result {
+        /** No valid Range header, send the whole content */
+        NONE,
+        /** At least one range can be sent */
+        SATISFIABLE,
+        /** None of the ranges can be sent, the response status is 416 */
+        UNSATISFIABLE
+    };
+
+    /** Position of the first byte */
+    qint64 first;
+
+    /** Position of the last byte, inclusive */
+    qint64 last;
+
+    /** Number of bytes in the range */
+    qint64 length() const;
+
+    /** Value of the Content-Range header for this range */
+    QByteArray contentRange( const qint64 size ) const;
+
+    /**
+       Parse a Range header, e.g. "bytes=0-499,1000-" or "bytes=-500".
+       Ranges that exceed the content are truncated, ranges behind its end are skipped.
+       Headers with more than maxRanges ranges are ignored, to prevent abuse.
+       Multiple ranges are sorted, and overlapping or adjacent ranges are merged.
+       @param header Value of the Range header
+       @param size Size of the content
+       @param ranges Receives the satisfiable ranges, in ascending order if there are several
+       @param maxRanges Maximum number of ranges
+     */
+    static Result parse( const QByteArray& header, const qint64 size, QList<HttpRange>& ranges, const int maxRanges = 16 );
+};
+
+} // end of namespace
+
+#endif // HTTPRANGE_H
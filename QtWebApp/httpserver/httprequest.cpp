@@ -6,96 +6,193 @@
 #include "httprequest.h"
 #include <QList>
 #include <QDir>
+#include <string.h>
 #include "httpcookie.h"
+#include "httpheaderscanner.h"
+#include "httprequesthandler.h"
 
 using namespace stefanfrings;
 
 HttpRequest::HttpRequest( const QSettings* settings ) :
+    m_scanPos( 0 ),
+    m_headerMapCreated( false ),
     m_status( WAIT_FOR_REQUEST ),
     m_maxSize( settings->value( "maxRequestSize", "16000" ).toInt() ),
     m_maxMultiPartSize( settings->value( "maxMultiPartSize", "1000000" ).toInt() ),
+    m_maxStreamedBodySize( settings->value( "maxStreamedBodySize", "100000000" ).toLongLong() ),
     m_currentSize( 0 ),
     m_expectedBodySize( 0 ),
-    m_tempFile( nullptr ) {}
+    m_multiPartParser( nullptr ),
+    m_uploadSink( nullptr ),
+    m_receivedBodySize( 0 ),
+    m_requestHandler( nullptr ),
+    m_bodyStreamed( false ),
+    m_abortStatusCode( 0 ),
+    m_chunked( false ),
+    m_chunkState( CHUNK_SIZE ),
+    m_chunkRemaining( 0 ) {}
+
+HttpRequest::HttpRequest( const HttpServerConfig* config ) :
+    m_scanPos( 0 ),
+    m_headerMapCreated( false ),
+    m_status( WAIT_FOR_REQUEST ),
+    m_maxSize( config->maxRequestSize ),
+    m_maxMultiPartSize( config->maxMultiPartSize ),
+    m_maxStreamedBodySize( config->maxStreamedBodySize ),
+    m_currentSize( 0 ),
+    m_expectedBodySize( 0 ),
+    m_multiPartParser( nullptr ),
+    m_uploadSink( nullptr ),
+    m_receivedBodySize( 0 ),
+    m_requestHandler( nullptr ),
+    m_bodyStreamed( false ),
+    m_abortStatusCode( 0 ),
+    m_chunked( false ),
+    m_chunkState( CHUNK_SIZE ),
+    m_chunkRemaining( 0 ) {}
 
-void HttpRequest::readRequest( QTcpSocket* socket ) {
-#ifdef SUPERVERBOSE
-    qDebug( "HttpRequest: read request" );
-#endif
-    int toRead = m_maxSize - m_currentSize + 1; // allow one byte more to be able to detect overflow
-    QByteArray dataRead = socket->readLine( toRead );
-    m_currentSize += dataRead.size();
-    m_lineBuffer.append( dataRead );
-    if ( !m_lineBuffer.contains( "\r\n" ) ) {
-#ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: collecting more parts until line break" );
-#endif
+void HttpRequest::readHeader( QTcpSocket* socket ) {
+    qint64 toRead = qMin<qint64>( m_maxSize - m_currentSize + 1, socket->bytesAvailable() ); // allow one byte more to be able to detect overflow
+    if ( toRead <= 0 ) {
         return;
     }
-    QByteArray newData = m_lineBuffer.trimmed();
-    m_lineBuffer.clear();
-    if ( !newData.isEmpty() ) {
+    // Look at the incoming bytes without taking them from the socket, because
+    // the bytes after the headers belong to the body or to the next request.
+    int oldSize = m_headerBuffer.size();
+    m_headerBuffer.resize( oldSize + int( toRead ) );
+    qint64 peeked = socket->peek( m_headerBuffer.data() + oldSize, toRead );
+    if ( peeked <= 0 ) {
+        m_headerBuffer.resize( oldSize );
+        return;
+    }
+    m_headerBuffer.resize( oldSize + int( peeked ) );
+
+    int headerEnd = parseHeaderLines( socket );
+    int newSize = headerEnd >= 0 ? headerEnd : m_headerBuffer.size();
+    // Now consume the bytes that belong to the headers. They are identical to the peeked ones.
+    socket->read( m_headerBuffer.data() + oldSize, newSize - oldSize );
+    m_headerBuffer.resize( newSize );
+    m_currentSize += newSize - oldSize;
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: from %s: %s", qPrintable( socket->peerAddress().toString() ), newData.data() );
-#endif
-        QList<QByteArray> list = newData.split( ' ' );
-        if ( list.count()!=3 || !list.at( 2 ).contains( "HTTP" ) ) {
-            qWarning( "HttpRequest: received broken HTTP request, invalid first line" );
-            m_status = ABORT;
-        }else {
-            m_method = list.at( 0 ).trimmed();
-            m_path = list.at( 1 );
-            m_version = list.at( 2 );
-            m_peerAddress = socket->peerAddress();
-            m_status = WAIT_FOR_HEADER;
-        }
+    if ( headerEnd < 0 ) {
+        qDebug( "HttpRequest: collecting more parts until line break" );
     }
+#endif
 }
 
-void HttpRequest::readHeader( QTcpSocket* socket ) {
-    int toRead=m_maxSize - m_currentSize + 1; // allow one byte more to be able to detect overflow
-    QByteArray dataRead = socket->readLine( toRead );
-    m_currentSize += dataRead.size();
-    m_lineBuffer.append( dataRead );
-    if ( !m_lineBuffer.contains( "\r\n" ) ) {
+int HttpRequest::parseHeaderLines( QTcpSocket* socket ) {
+    const char* buffer = m_headerBuffer.constData();
+    const int size = m_headerBuffer.size();
+    HttpHeaderLine lines[64];
+    while ( m_status == WAIT_FOR_REQUEST || m_status == WAIT_FOR_HEADER ) {
+        // Find the boundaries and colons of all complete lines in one pass
+        int count = HttpHeaderScanner::scan( buffer, m_scanPos, size, lines, 64 );
+        if ( count == 0 ) {
+            return -1;
+        }
+        for ( int i = 0; i < count && ( m_status == WAIT_FOR_REQUEST || m_status == WAIT_FOR_HEADER ); ++i ) {
+            int start = m_scanPos;
+            int end = lines[i].end;
+            int colon = lines[i].colon;
+            m_scanPos = end + 1;
+            if ( end > start && buffer[end - 1] == '\r' ) {
+                --end;
+            }
+
+            if ( m_status == WAIT_FOR_REQUEST ) {
+                // Ignore empty lines before the request
+                if ( end > start ) {
+                    parseRequestLine( start, end, socket );
+                }
+                continue;
+            }
+
+            if ( end == start ) {
+                // received an empty line - end of headers reached
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: collecting more parts until line break" );
+                qDebug( "HttpRequest: headers completed" );
 #endif
-        return;
-    }
-    QByteArray newData = m_lineBuffer.trimmed();
-    m_lineBuffer.clear();
-    int colon = newData.indexOf( ':' );
-    if ( colon > 0 ) {
-        // Received a line with a colon - a header
-        m_currentHeader = newData.left( colon ).toLower();
-        QByteArray value = newData.mid( colon + 1 ).trimmed();
-        m_headers.insert( m_currentHeader, value );
+                headersComplete();
+                return m_scanPos;
+            }
+
+            if ( colon > start && buffer[start] != ' ' && buffer[start] != '\t' ) {
+                // Received a line with a colon - a header
+                HeaderField field;
+                field.nameOffset = start;
+                field.nameLength = colon - start;
+                int valueStart = colon + 1;
+                int valueEnd = end;
+                while ( valueStart < valueEnd && ( buffer[valueStart] == ' ' || buffer[valueStart] == '\t' ) ) {
+                    ++valueStart;
+                }
+                while ( valueEnd > valueStart && ( buffer[valueEnd - 1] == ' ' || buffer[valueEnd - 1] == '\t' ) ) {
+                    --valueEnd;
+                }
+                field.valueOffset = valueStart;
+                field.valueLength = valueEnd - valueStart;
+                field.folded = false;
+                m_headerFields.append( field );
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: received header %s: %s", currentHeader.data(), value.data() );
+                qDebug( "HttpRequest: received header %s", QByteArray( buffer + start, end - start ).data() );
 #endif
-        return;
-    }
-
-    if ( !newData.isEmpty() ) {
-        // received another line - belongs to the previous header
+            } else if ( !m_headerFields.isEmpty() ) {
+                // Received additional line of previous header, which directly follows in the buffer
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: read additional line of header" );
+                qDebug( "HttpRequest: read additional line of header" );
 #endif
-        // Received additional line of previous header
-        if ( m_headers.contains( m_currentHeader ) ) {
-            m_headers.insert( m_currentHeader, m_headers.value( m_currentHeader ) + " " + newData );
+                HeaderField& field = m_headerFields.last();
+                int valueEnd = end;
+                while ( valueEnd > start && ( buffer[valueEnd - 1] == ' ' || buffer[valueEnd - 1] == '\t' ) ) {
+                    --valueEnd;
+                }
+                if ( field.valueLength == 0 ) {
+                    // The previous value is empty, so the value starts on this line
+                    int valueStart = start;
+                    while ( valueStart < valueEnd && ( buffer[valueStart] == ' ' || buffer[valueStart] == '\t' ) ) {
+                        ++valueStart;
+                    }
+                    field.valueOffset = valueStart;
+                }
+                field.valueLength = valueEnd - field.valueOffset;
+                field.folded = true;
+            }
         }
-        return;
     }
+    return -1;
+}
 
-    // received an empty line - end of headers reached
+void HttpRequest::parseRequestLine( const int start, const int end, QTcpSocket* socket ) {
+    const char* line = m_headerBuffer.constData() + start;
+    const int length = end - start;
 #ifdef SUPERVERBOSE
-    qDebug( "HttpRequest: headers completed" );
+    qDebug( "HttpRequest: from %s: %s", qPrintable( socket->peerAddress().toString() ), QByteArray( line, length ).data() );
 #endif
-    // Empty line received, that means all headers have been received
+    // The line must consist of exactly three parts, separated by single spaces
+    const char* space1 = static_cast<const char*>( memchr( line, ' ', size_t( length ) ) );
+    const char* space2 = space1 ? static_cast<const char*>( memchr( space1 + 1, ' ', size_t( line + length - space1 - 1 ) ) ) : nullptr;
+    const char* space3 = space2 ? static_cast<const char*>( memchr( space2 + 1, ' ', size_t( line + length - space2 - 1 ) ) ) : nullptr;
+    if ( !space2 || space3 || space1 == line || space2 == space1 + 1 || space2 == line + length - 1 ) {
+        qWarning( "HttpRequest: received broken HTTP request, invalid first line" );
+        m_status = ABORT;
+        return;
+    }
+    QByteArray version( space2 + 1, int( line + length - space2 - 1 ) );
+    if ( !version.contains( "HTTP" ) ) {
+        qWarning( "HttpRequest: received broken HTTP request, invalid first line" );
+        m_status = ABORT;
+        return;
+    }
+    m_method = QByteArray( line, int( space1 - line ) );
+    m_path = QByteArray( space1 + 1, int( space2 - space1 - 1 ) );
+    m_version = version;
+    m_peerAddress = socket->peerAddress();
+    m_status = WAIT_FOR_HEADER;
+}
+
+void HttpRequest::headersComplete() {
     // Check for multipart/form-data
-    QByteArray contentType = m_headers.value( "content-type" );
+    QByteArray contentType = getHeader( "content-type" );
     if ( contentType.startsWith( "multipart/form-data" ) ) {
         int posi = contentType.indexOf( "boundary=" );
         if ( posi >= 0 ) {
@@ -105,17 +202,50 @@ void HttpRequest::readHeader( QTcpSocket* socket ) {
             }
         }
     }
-    QByteArray contentLength = m_headers.value( "content-length" );
-    if ( !contentLength.isEmpty() ) {
-        m_expectedBodySize = contentLength.toInt();
+    QByteArray transferEncoding = getHeader( "transfer-encoding" ).trimmed();
+    if ( !transferEncoding.isEmpty() ) {
+        // Chunked must be the last transfer coding, then the content-length is ignored
+        if ( !transferEncoding.toLower().endsWith( "chunked" ) ) {
+            qWarning( "HttpRequest: unsupported transfer-encoding %s", transferEncoding.data() );
+            m_status = ABORT;
+            return;
+        }
+        m_chunked = true;
+    } else {
+        QByteArray contentLength = getHeader( "content-length" );
+        if ( !contentLength.isEmpty() ) {
+            m_expectedBodySize = contentLength.toLongLong();
+        }
+    }
+
+    // Let the request handler decide whether it wants to receive the body in blocks
+    if ( m_requestHandler ) {
+        try {
+            m_bodyStreamed = m_requestHandler->headersReceived( *this ) && m_boundary.isEmpty();
+        } catch ( ... ) {
+            qCritical( "HttpRequest: An uncatched exception occured in the request handler" );
+            m_status = ABORT;
+            return;
+        }
     }
 
-    if ( m_expectedBodySize == 0 ) {
+    if ( m_expectedBodySize < 0 ) {
+        qWarning( "HttpRequest: invalid content-length" );
+        m_status = ABORT;
+    } else if ( m_chunked ) {
+#ifdef SUPERVERBOSE
+        qDebug( "HttpRequest: expect chunked body" );
+#endif
+        startBody();
+    } else if ( m_expectedBodySize == 0 ) {
 #ifdef SUPERVERBOSE
         qDebug( "HttpRequest: expect no body" );
 #endif
         m_status = COMPLETE;
-    } else if ( m_boundary.isEmpty() && m_expectedBodySize + m_currentSize>m_maxSize ) {
+    } else if ( m_bodyStreamed && m_expectedBodySize>m_maxStreamedBodySize ) {
+        qWarning( "HttpRequest: expected streamed body is too large" );
+        m_status = ABORT;
+    } else if ( !m_bodyStreamed && m_boundary.isEmpty() && m_expectedBodySize + m_currentSize>m_maxSize ) {
         qWarning( "HttpRequest: expected body is too large" );
         m_status = ABORT;
     } else if ( !m_boundary.isEmpty() && m_expectedBodySize>m_maxMultiPartSize ) {
@@ -123,63 +253,197 @@ void HttpRequest::readHeader( QTcpSocket* socket ) {
         m_status = ABORT;
     } else {
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: expect %i bytes body", expectedBodySize );
+        qDebug( "HttpRequest: expect %lli bytes body", m_expectedBodySize );
 #endif
-        m_status = WAIT_FOR_BODY;
+        startBody();
+    }
+}
+
+void HttpRequest::startBody() {
+    if ( !m_boundary.isEmpty() ) {
+        m_multiPartParser = new HttpMultiPartParser( m_boundary, m_maxSize, &m_parameters, &m_uploadedFiles );
+        m_multiPartParser->setUploadSink( m_uploadSink );
     }
+    m_status = WAIT_FOR_BODY;
+}
+
+int HttpRequest::findHeader( const QByteArray& name, const int before ) const {
+    const char* buffer = m_headerBuffer.constData();
+    for ( int i = before - 1; i >= 0; --i ) {
+        const HeaderField& field = m_headerFields.at( i );
+        if ( field.nameLength == name.size() && qstrnicmp( buffer + field.nameOffset, name.constData(), uint( field.nameLength ) ) == 0 ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QByteArray HttpRequest::headerValue( const HeaderField& field ) const {
+    if ( !field.folded ) {
+        return m_headerBuffer.mid( field.valueOffset, field.valueLength );
+    }
+    // Join the lines of a folded header with single spaces
+    QByteArray value;
+    value.reserve( field.valueLength );
+    const char* ptr = m_headerBuffer.constData() + field.valueOffset;
+    const char* end = ptr + field.valueLength;
+    while ( ptr < end ) {
+        if ( *ptr == '\r' || *ptr == '\n' ) {
+            while ( ptr < end && ( *ptr == '\r' || *ptr == '\n' || *ptr == ' ' || *ptr == '\t' ) ) {
+                ++ptr;
+            }
+            value.append( ' ' );
+        } else {
+            value.append( *ptr++ );
+        }
+    }
+    return value;
 }
 
 void HttpRequest::readBody( QTcpSocket* socket ) {
+    if ( m_chunked ) {
+        readChunkedBody( socket );
+        return;
+    }
     Q_ASSERT( m_expectedBodySize != 0 );
-    if ( m_boundary.isEmpty() ) {
-        // normal body, no multipart
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: receive body" );
+    qDebug( "HttpRequest: receive body" );
 #endif
-        int toRead = m_expectedBodySize - m_bodyData.size();
+    // Transfer data in 64kb blocks
+    qint64 toRead = m_expectedBodySize - m_receivedBodySize;
+    if ( toRead > 65536 ) {
+        toRead = 65536;
+    }
+    if ( !processBody( socket->read( toRead ) ) ) {
+        m_status = ABORT;
+    } else if ( m_receivedBodySize >= m_expectedBodySize ) {
+        bodyComplete();
+    }
+}
+
+void HttpRequest::readChunkedBody( QTcpSocket* socket ) {
+    if ( m_chunkState == CHUNK_DATA ) {
+        qint64 toRead = m_chunkRemaining;
+        if ( toRead > 65536 ) {
+            toRead = 65536;
+        }
         QByteArray newData = socket->read( toRead );
-        m_currentSize += newData.size();
-        m_bodyData.append( newData );
-        if ( m_bodyData.size() >= m_expectedBodySize ) {
-            m_status = COMPLETE;
+        m_chunkRemaining -= newData.size();
+        if ( !processBody( newData ) ) {
+            m_status = ABORT;
+        } else if ( m_chunkRemaining == 0 ) {
+            m_chunkState = CHUNK_DATA_END;
         }
+        return;
+    }
 
+    // All other states expect a line. Take what is available, the line might be incomplete.
+    m_chunkLine.append( socket->readLine( m_maxSize - m_chunkLine.size() + 1 ) );
+    if ( !m_chunkLine.endsWith( '\n' ) ) {
+        if ( m_chunkLine.size() > m_maxSize ) {
+            qWarning( "HttpRequest: chunk line is too long" );
+            m_status = ABORT;
+        }
         return;
     }
+    QByteArray line = m_chunkLine.trimmed();
+
+    if ( m_chunkState == CHUNK_SIZE ) {
+        // The size may be followed by extensions, which are ignored
+        int semicolon = line.indexOf( ';' );
+        if ( semicolon >= 0 ) {
+            line = line.left( semicolon ).trimmed();
+        }
+        bool ok;
+        m_chunkRemaining = line.toLongLong( &ok, 16 );
+        if ( !ok || m_chunkRemaining < 0 ) {
+            qWarning( "HttpRequest: invalid chunk size" );
+            m_status = ABORT;
+        } else if ( m_chunkRemaining == 0 ) {
+#ifdef SUPERVERBOSE
+            qDebug( "HttpRequest: last chunk received" );
+#endif
+            m_chunkState = CHUNK_TRAILER;
+        } else {
+            m_chunkState = CHUNK_DATA;
+        }
+
+    } else if ( m_chunkState == CHUNK_DATA_END ) {
+        if ( !line.isEmpty() ) {
+            qWarning( "HttpRequest: chunk data is not terminated by a line break" );
+            m_status = ABORT;
+        }
+        m_chunkState = CHUNK_SIZE;
+
+    } else if ( line.isEmpty() ) {
+        // End of the trailer
+        bodyComplete();
 
-    // multipart body, store into temp file
+    } else {
+        // Trailer fields are kept apart, they must not override the headers (RFC 7230 section 4.1.2)
+        int colon = line.indexOf( ':' );
+        if ( colon > 0 ) {
+            m_currentSize += m_chunkLine.size();
+            m_trailers.insert( line.left( colon ).trimmed().toLower(), line.mid( colon + 1 ).trimmed() );
 #ifdef SUPERVERBOSE
-    qDebug( "HttpRequest: receiving multipart body" );
+            qDebug( "HttpRequest: received trailer %s", line.data() );
 #endif
-    // Create an object for the temporary file, if not already present
-    if ( m_tempFile == nullptr ) {
-        m_tempFile = new QTemporaryFile;
+        }
     }
-    if ( !m_tempFile->isOpen() ) {
-        m_tempFile->open();
+    m_chunkLine.clear();
+}
+
+bool HttpRequest::processBody( const QByteArray& data ) {
+    m_receivedBodySize += data.size();
+    if ( m_bodyStreamed ) {
+        // streamed body, pass it to the request handler
+        if ( m_receivedBodySize > m_maxStreamedBodySize ) {
+            qWarning( "HttpRequest: received too many bytes" );
+            return false;
+        }
+        bool accepted = false;
+        try {
+            accepted = m_requestHandler->receiveBody( *this, data.constData(), data.size() );
+        } catch ( ... ) {
+            qCritical( "HttpRequest: An uncatched exception occured in the request handler" );
+            if ( m_abortStatusCode == 0 ) {
+                setAbortStatus( 500, "internal server error" );
+            }
+        }
+        if ( !accepted ) {
+            qWarning( "HttpRequest: request handler rejected the body" );
+            if ( m_abortStatusCode == 0 ) {
+                setAbortStatus( 400, "bad request" );
+            }
+        }
+        return accepted;
     }
-    // Transfer data in 64kb blocks
-    qint64 fileSize = m_tempFile->size();
-    qint64 toRead = m_expectedBodySize - fileSize;
-    if ( toRead > 65536 ) {
-        toRead = 65536;
+    m_currentSize += data.size();
+    if ( m_multiPartParser ) {
+        // multipart body, parse while receiving
+        if ( !m_multiPartParser->write( data.constData(), data.size() ) ) {
+            qWarning( "HttpRequest: cannot process multipart body" );
+            return false;
+        }
+        return true;
     }
-    fileSize += m_tempFile->write( socket->read( toRead ) );
-    if ( fileSize >= m_maxMultiPartSize ) {
-        qWarning( "HttpRequest: received too many multipart bytes" );
-        m_status = ABORT;
-    } else if ( fileSize >= m_expectedBodySize ) {
+    // normal body, no multipart
+    m_bodyData.append( data );
+    return true;
+}
+
+void HttpRequest::bodyComplete() {
 #ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: received whole multipart body" );
+    qDebug( "HttpRequest: received whole body" );
 #endif
-        m_tempFile->flush();
-        if ( m_tempFile->error() ) {
-            qCritical( "HttpRequest: Error writing temp file for multipart body" );
+    if ( m_multiPartParser ) {
+        if ( !m_multiPartParser->isFinished() ) {
+            qWarning( "HttpRequest: format error, unexpected end of multipart body" );
         }
-        parseMultiPartFile();
-        m_tempFile->close();
-        m_status = COMPLETE;
+        delete m_multiPartParser;
+        m_multiPartParser = nullptr;
     }
+    m_status = COMPLETE;
 }
 
 void HttpRequest::decodeRequestParams() {
@@ -194,7 +458,7 @@ void HttpRequest::decodeRequestParams() {
         m_path=m_path.left( questionMark );
     }
     // Get request body parameters
-    QByteArray contentType = m_headers.value( "content-type" );
+    QByteArray contentType = getHeader( "content-type" );
     if ( !m_bodyData.isEmpty() && ( contentType.isEmpty() || contentType.startsWith( "application/x-www-form-urlencoded" ) ) ) {
         if ( !rawParameters.isEmpty() ) {
             rawParameters.append( '&' );
@@ -217,7 +481,7 @@ void HttpRequest::extractCookies() {
 #ifdef SUPERVERBOSE
     qDebug( "HttpRequest: extract cookies" );
 #endif
-    const auto cookies = m_headers.values( "cookie" );
+    const auto cookies = getHeaders( "cookie" );
     for ( const QByteArray& cookieStr : cookies ) {
         const QList<QByteArray> list = HttpCookie::splitCSV( cookieStr );
 
@@ -231,15 +495,18 @@ void HttpRequest::extractCookies() {
             m_cookies.insert( name, value );
         }
     }
-    m_headers.remove( "cookie" );
+    // The cookies are available by getCookie(), so remove the raw headers
+    for ( int i = m_headerFields.size() - 1; i >= 0; --i ) {
+        const HeaderField& field = m_headerFields.at( i );
+        if ( field.nameLength == 6 && qstrnicmp( m_headerBuffer.constData() + field.nameOffset, "cookie", 6 ) == 0 ) {
+            m_headerFields.remove( i );
+        }
+    }
 }
 
 void HttpRequest::readFromSocket( QTcpSocket* socket ) {
     Q_ASSERT( m_status != COMPLETE );
-    if ( m_status == WAIT_FOR_REQUEST ) {
-        readRequest( socket );
-
-    } else if ( m_status == WAIT_FOR_HEADER ) {
+    if ( m_status == WAIT_FOR_REQUEST || m_status == WAIT_FOR_HEADER ) {
         readHeader( socket );
 
     } else if ( m_status == WAIT_FOR_BODY ) {
@@ -279,14 +546,39 @@ QByteArray HttpRequest::getVersion() const {
 }
 
 QByteArray HttpRequest::getHeader( const QByteArray& name ) const {
-    return m_headers.value( name.toLower() );
+    int index = findHeader( name, m_headerFields.size() );
+    if ( index < 0 ) {
+        return QByteArray();
+    }
+    return headerValue( m_headerFields.at( index ) );
+}
+
+QByteArray HttpRequest::getTrailer( const QByteArray& name ) const {
+    return m_trailers.value( name.toLower() );
+}
+
+const QMultiMap<QByteArray, QByteArray>& HttpRequest::getTrailerMap() const {
+    return m_trailers;
 }
 
 QList<QByteArray> HttpRequest::getHeaders( const QByteArray& name ) const {
-    return m_headers.values( name.toLower() );
+    // Like QMultiMap::values(), the most recently received header comes first
+    QList<QByteArray> values;
+    int index = findHeader( name, m_headerFields.size() );
+    while ( index >= 0 ) {
+        values.append( headerValue( m_headerFields.at( index ) ) );
+        index = findHeader( name, index );
+    }
+    return values;
 }
 
 const QMultiMap<QByteArray, QByteArray>& HttpRequest::getHeaderMap() const {
+    if ( !m_headerMapCreated ) {
+        for ( const HeaderField& field : m_headerFields ) {
+            m_headers.insert( m_headerBuffer.mid( field.nameOffset, field.nameLength ).toLower(), headerValue( field ) );
+        }
+        m_headerMapCreated = true;
+    }
     return m_headers;
 }
 
@@ -326,111 +618,6 @@ QByteArray HttpRequest::urlDecode( const QByteArray& source ) {
     return buffer;
 }
 
-void HttpRequest::parseMultiPartFile() {
-    qDebug( "HttpRequest: parsing multipart temp file" );
-    m_tempFile->seek( 0 );
-    bool finished = false;
-    while ( !m_tempFile->atEnd() && !finished && !m_tempFile->error() ) {
-#ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: reading multpart headers" );
-#endif
-        QByteArray fieldName;
-        QByteArray fileName;
-        while ( !m_tempFile->atEnd() && !finished && !m_tempFile->error() ) {
-            QByteArray line=m_tempFile->readLine( 65536 ).trimmed();
-            if ( line.startsWith( "Content-Disposition:" ) ) {
-                if ( line.contains( "form-data" ) ) {
-                    int start = line.indexOf( " name=\"" );
-                    int end = line.indexOf( "\"", start + 7 );
-                    if ( start >= 0 && end >= start ) {
-                        fieldName=line.mid( start + 7, end - start - 7 );
-                    }
-                    start = line.indexOf( " filename=\"" );
-                    end = line.indexOf( "\"", start + 11 );
-                    if ( start >= 0 && end >= start ) {
-                        fileName=line.mid( start + 11, end - start - 11 );
-                    }
-#ifdef SUPERVERBOSE
-                    qDebug( "HttpRequest: multipart field=%s, filename=%s", fieldName.data(), fileName.data() );
-#endif
-                } else {
-#ifdef SUPERVERBOSE
-                    qDebug( "HttpRequest: ignoring unsupported content part %s", line.data() );
-#endif
-                }
-            } else if ( line.isEmpty() ) {
-                break;
-            }
-        }
-
-#ifdef SUPERVERBOSE
-        qDebug( "HttpRequest: reading multpart data" );
-#endif
-        QTemporaryFile* uploadedFile=nullptr;
-        QByteArray fieldValue;
-        while ( !m_tempFile->atEnd() && !finished && !m_tempFile->error() ) {
-            QByteArray line = m_tempFile->readLine( 65536 );
-            if ( line.startsWith( "--" + m_boundary ) ) {
-                // Boundary found. Until now we have collected 2 bytes too much,
-                // so remove them from the last result
-                if ( fileName.isEmpty() && !fieldName.isEmpty() ) {
-                    // last field was a form field
-                    fieldValue.remove( fieldValue.size() - 2, 2 );
-                    m_parameters.insert( fieldName, fieldValue );
-#ifdef SUPERVERBOSE
-                    qDebug( "HttpRequest: set parameter %s=%s", fieldName.data(), fieldValue.data() );
-#endif
-                } else if ( !fileName.isEmpty() && !fieldName.isEmpty() ) {
-                    // last field was a file
-                    if ( uploadedFile ) {
-#ifdef SUPERVERBOSE
-                        qDebug( "HttpRequest: finishing writing to uploaded file" );
-#endif
-                        uploadedFile->resize( uploadedFile->size() - 2 );
-                        uploadedFile->flush();
-                        uploadedFile->seek( 0 );
-                        m_parameters.insert( fieldName, fileName );
-                        qDebug( "HttpRequest: set parameter %s=%s", fieldName.data(), fileName.data() );
-                        m_uploadedFiles.insert( fieldName, uploadedFile );
-#ifdef SUPERVERBOSE
-                        long int fileSize=(long int) uploadedFile->size();
-                        qDebug( "HttpRequest: uploaded file size is %li", fileSize );
-#endif
-                    } else {
-                        qWarning( "HttpRequest: format error, unexpected end of file data" );
-                    }
-                }
-                if ( line.contains( m_boundary + "--" ) ) {
-                    finished = true;
-                }
-                break;
-            } else {
-                if ( fileName.isEmpty() && !fieldName.isEmpty() ) {
-                    // this is a form field.
-                    m_currentSize += line.size();
-                    fieldValue.append( line );
-                } else if ( !fileName.isEmpty() && !fieldName.isEmpty() ) {
-                    // this is a file
-                    if ( !uploadedFile ) {
-                        uploadedFile = new QTemporaryFile();
-                        uploadedFile->open();
-                    }
-                    uploadedFile->write( line );
-                    if ( uploadedFile->error() ) {
-                        qCritical( "HttpRequest: error writing temp file, %s", qPrintable( uploadedFile->errorString() ) );
-                    }
-                }
-            }
-        }
-    }
-    if ( m_tempFile->error() ) {
-        qCritical( "HttpRequest: cannot read temp file, %s", qPrintable( m_tempFile->errorString() ) );
-    }
-#ifdef SUPERVERBOSE
-    qDebug( "HttpRequest: finished parsing multipart temp file" );
-#endif
-}
-
 HttpRequest::~HttpRequest() {
     for ( auto uploadedFile = m_uploadedFiles.cbegin(); uploadedFile != m_uploadedFiles.cend(); ++uploadedFile ) {
         QTemporaryFile* file = m_uploadedFiles.value( uploadedFile.key() );
@@ -439,18 +626,45 @@ HttpRequest::~HttpRequest() {
         }
         delete file;
     }
-    if ( m_tempFile != nullptr ) {
-        if ( m_tempFile->isOpen() ) {
-            m_tempFile->close();
-        }
-        delete m_tempFile;
-    }
+    delete m_multiPartParser;
 }
 
 QTemporaryFile* HttpRequest::getUploadedFile( const QByteArray& fieldName ) const {
     return m_uploadedFiles.value( fieldName );
 }
 
+void HttpRequest::setUploadSink( HttpUploadSink* sink ) {
+    m_uploadSink = sink;
+    if ( m_multiPartParser ) {
+        m_multiPartParser->setUploadSink( sink );
+    }
+}
+
+void HttpRequest::setRequestHandler( HttpRequestHandler* handler ) {
+    m_requestHandler = handler;
+}
+
+void HttpRequest::setAbortStatus( const int statusCode, const QByteArray& description ) {
+    m_abortStatusCode = statusCode;
+    m_abortStatusText = description;
+}
+
+int HttpRequest::getAbortStatusCode() const {
+    return m_abortStatusCode ? m_abortStatusCode : 413;
+}
+
+QByteArray HttpRequest::getAbortStatusText() const {
+    return m_abortStatusCode ? m_abortStatusText : QByteArray( "entity too large" );
+}
+
+bool HttpRequest::isBodyStreamed() const {
+    return m_bodyStreamed;
+}
+
+qint64 HttpRequest::getContentLength() const {
+    return m_chunked ? -1 : m_expectedBodySize;
+}
+
 QByteArray HttpRequest::getCookie( const QByteArray& name ) const {
     return m_cookies.value( name );
 }
@@ -11,13 +11,18 @@
 #include <QTcpSocket>
 #include <QMap>
 #include <QMultiMap>
+#include <QVector>
 #include <QSettings>
 #include <QTemporaryFile>
 #include <QUuid>
 #include "httpglobal.h"
+#include "httpserverconfig.h"
+#include "httpmultipartparser.h"
 
 namespace stefanfrings {
 
+class HttpRequestHandler;
+
 /**
    This object represents a single HTTP request. It reads the request
    from a TCP socket and provides getters for the individual parts
@@ -27,12 +32,28 @@ namespace stefanfrings {
    <code><pre>
    maxRequestSize=16000
    maxMultiPartSize=1000000
+   maxStreamedBodySize=100000000
    </pre></code>
    <p>
    MaxRequestSize is the maximum size of a HTTP request. In case of
    multipart/form-data requests (also known as file-upload), the maximum
    size of the body must not exceed maxMultiPartSize.
    The body is always a little larger than the file itself.
+   <p>
+   Multipart bodies are parsed while they are received. Form fields are kept in
+   memory, uploaded files are written directly into temporary files, or passed to
+   a HttpUploadSink.
+   <p>
+   If the request handler returns true from HttpRequestHandler::headersReceived(),
+   the body is not collected but passed to HttpRequestHandler::receiveBody() in blocks
+   as they arrive. Such a body may be up to maxStreamedBodySize bytes large.
+   <p>
+   Bodies with Transfer-Encoding: chunked are decoded while they are received and
+   are subject to the same size limits. Trailer fields are available by getTrailer().
+   <p>
+   The request line and the headers are collected in a single buffer and parsed in place.
+   Headers are stored as positions within that buffer, so no memory is allocated per
+   header. Header values are copied only when they are requested.
  */
 
 class DECLSPEC HttpRequest {
@@ -49,6 +70,12 @@ public:
      */
     explicit HttpRequest( const QSettings* settings );
 
+    /**
+       Constructor.
+       @param config Parsed configuration of the HTTP server
+     */
+    explicit HttpRequest( const HttpServerConfig* config );
+
     /**
        Destructor.
      */
@@ -96,10 +123,23 @@ public:
 
     /**
      * Get all HTTP request headers. Note that the header names
-     * are returned in lower-case.
+     * are returned in lower-case. The map is created on the first call,
+     * prefer getHeader() to access single headers.
      */
     const QMultiMap<QByteArray, QByteArray>& getHeaderMap() const;
 
+    /**
+       Get the value of a trailer field, received after a chunked body.
+       Trailer fields are kept apart from the headers, so they cannot replace
+       headers like Cookie, Host or Content-Type.
+       @param name Name of the field, not case-sensitive.
+       @return If the field occurs multiple times, only the last one is returned.
+     */
+    QByteArray getTrailer( const QByteArray& name ) const;
+
+    /** Get all trailer fields, the names are returned in lower-case. */
+    const QMultiMap<QByteArray, QByteArray>& getTrailerMap() const;
+
     /**
        Get the value of a HTTP request parameter.
        @param name Name of the parameter, case-sensitive.
@@ -138,6 +178,41 @@ public:
      */
     QTemporaryFile* getUploadedFile( const QByteArray& fieldName ) const;
 
+    /**
+       Pass uploaded files to the given sink instead of storing them in
+       temporary files. Files that are passed to the sink are not available
+       by getUploadedFile(). Must be called before the body is received.
+       @param sink Receiver of the files, must live until this request is deleted
+     */
+    void setUploadSink( HttpUploadSink* sink );
+
+    /**
+       Set the request handler that is notified when the headers have been received
+       and that may receive the body in blocks.
+       @param handler The request handler, or nullptr to collect the whole body
+       @see HttpRequestHandler::headersReceived()
+     */
+    void setRequestHandler( HttpRequestHandler* handler );
+
+    /** Whether the body is passed to HttpRequestHandler::receiveBody() instead of getBody() */
+    bool isBodyStreamed() const;
+
+    /**
+       Set the status of the error response, that the client gets when the request is aborted.
+       A request handler may call this before HttpRequestHandler::receiveBody() returns false.
+       Otherwise a rejected body is answered with 400, and requests that exceed a size limit with 413.
+     */
+    void setAbortStatus( const int statusCode, const QByteArray& description );
+
+    /** Status code of the error response for an aborted request */
+    int getAbortStatusCode() const;
+
+    /** Status description of the error response for an aborted request */
+    QByteArray getAbortStatusText() const;
+
+    /** Get the size of the body as announced by the Content-Length header, -1 for chunked bodies */
+    qint64 getContentLength() const;
+
     /**
        Get the value of a cookie.
        @param name Name of the cookie
@@ -155,8 +230,33 @@ public:
     const QHostAddress& getPeerAddress() const;
 
 private:
-    /** Request headers */
-    QMultiMap<QByteArray, QByteArray> m_headers;
+    /** Position of a received header within m_headerBuffer */
+    struct HeaderField {
+        int nameOffset;
+        int nameLength;
+        int valueOffset;
+        int valueLength;
+        /** The value continues on following lines, which must be joined */
+        bool folded;
+    };
+
+    /** Raw request line and headers, exactly as received */
+    QByteArray m_headerBuffer;
+
+    /** Position of the first byte in m_headerBuffer that has not been parsed yet */
+    int m_scanPos;
+
+    /** Received headers, in the order of their occurence */
+    QVector<HeaderField> m_headerFields;
+
+    /** Request headers with lower-case names, created on demand by getHeaderMap() */
+    mutable QMultiMap<QByteArray, QByteArray> m_headers;
+
+    /** Whether m_headers has been created */
+    mutable bool m_headerMapCreated;
+
+    /** Trailer fields of a chunked body, with lower-case names */
+    QMultiMap<QByteArray, QByteArray> m_trailers;
 
     /** Parameters of the request */
     QMultiMap<QByteArray, QByteArray> m_parameters;
@@ -194,42 +294,107 @@ private:
     /** Maximum allowed size of multipart forms in bytes. */
     int m_maxMultiPartSize;
 
+    /** Maximum allowed size of streamed bodies in bytes. */
+    qint64 m_maxStreamedBodySize;
+
     /** Current size */
     int m_currentSize;
 
     /** Expected size of body */
-    int m_expectedBodySize;
-
-    /** Name of the current header, or empty if no header is being processed */
-    QByteArray m_currentHeader;
+    qint64 m_expectedBodySize;
 
     /** Boundary of multipart/form-data body. Empty if there is no such header */
     QByteArray m_boundary;
 
-    /** Temp file, that is used to store the multipart/form-data body */
-    QTemporaryFile* m_tempFile;
+    /** Parser of the multipart/form-data body, created when the headers are complete */
+    HttpMultiPartParser* m_multiPartParser;
+
+    /** Receiver of uploaded files, or nullptr to use temporary files */
+    HttpUploadSink* m_uploadSink;
+
+    /** Number of body bytes received so far */
+    qint64 m_receivedBodySize;
+
+    /** Notified about the headers, and receives the body if m_bodyStreamed is set */
+    HttpRequestHandler* m_requestHandler;
+
+    /** Whether the body is passed to m_requestHandler */
+    bool m_bodyStreamed;
+
+    /** Status code of the error response for an aborted request, 0 for the default */
+    int m_abortStatusCode;
 
-    /** Parse the multipart body, that has been stored in the temp file. */
-    void parseMultiPartFile();
+    /** Status description of the error response for an aborted request */
+    QByteArray m_abortStatusText;
 
-    /** Sub-procedure of readFromSocket(), read the first line of a request. */
-    void readRequest( QTcpSocket* socket );
+    /** States of the decoder for chunked bodies */
+    enum ChunkState {CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER};
 
-    /** Sub-procedure of readFromSocket(), read header lines. */
+    /** Whether the body has Transfer-Encoding: chunked */
+    bool m_chunked;
+
+    /** State of the decoder for chunked bodies */
+    ChunkState m_chunkState;
+
+    /** Number of bytes that are still missing from the current chunk */
+    qint64 m_chunkRemaining;
+
+    /** Incomplete line of a chunked body (chunk size or trailer) */
+    QByteArray m_chunkLine;
+
+    /**
+       Sub-procedure of readFromSocket(), read the request line and the headers.
+       Only the bytes up to the end of the headers are taken from the socket.
+     */
     void readHeader( QTcpSocket* socket );
 
+    /**
+       Parse all complete lines in m_headerBuffer after m_scanPos.
+       @return position after the empty line that terminates the headers, or -1 if not reached yet
+     */
+    int parseHeaderLines( QTcpSocket* socket );
+
+    /** Parse the request line between the given positions of m_headerBuffer */
+    void parseRequestLine( const int start, const int end, QTcpSocket* socket );
+
+    /** Evaluate the headers after all of them have been received */
+    void headersComplete();
+
+    /**
+       Find a header by name.
+       @param name Name of the header, not case-senitive
+       @param before Search only headers before this index
+       @return index in m_headerFields of the last matching header, or -1
+     */
+    int findHeader( const QByteArray& name, const int before ) const;
+
+    /** Copy the value of a header from m_headerBuffer, folded lines are joined */
+    QByteArray headerValue( const HeaderField& field ) const;
+
+    /** Prepare for receiving the body */
+    void startBody();
+
     /** Sub-procedure of readFromSocket(), read the request body. */
     void readBody( QTcpSocket* socket );
 
+    /** Sub-procedure of readBody(), decode the next part of a chunked body. */
+    void readChunkedBody( QTcpSocket* socket );
+
+    /**
+       Pass received body data to the request handler, the multipart parser or m_bodyData.
+       @return false if the request must be aborted
+     */
+    bool processBody( const QByteArray& data );
+
+    /** Called after the last byte of the body has been received */
+    void bodyComplete();
+
     /** Sub-procedure of readFromSocket(), extract and decode request parameters. */
     void decodeRequestParams();
 
     /** Sub-procedure of readFromSocket(), extract cookies from headers */
     void extractCookies();
 
-    /** Buffer for collecting characters of request and header lines */
-    QByteArray m_lineBuffer;
-
 };
 
 } // end of namespace
@@ -24,3 +24,19 @@ void HttpRequestHandler::service( HttpRequest& request, HttpResponse& response )
     response.setStatus( 501, "not implemented" );
     response.write( "501 not implemented", true );
 }
+
+bool HttpRequestHandler::headersReceived( HttpRequest& request ) {
+    Q_UNUSED( request )
+    return false;
+}
+
+bool HttpRequestHandler::receiveBody( HttpRequest& request, const char* data, const int size ) {
+    Q_UNUSED( request )
+    Q_UNUSED( data )
+    Q_UNUSED( size )
+    qCritical( "HttpRequestHandler: you need to override the receiveBody() function" );
+    return false;
+}
+
+void HttpRequestHandler::warmUp()
+{}
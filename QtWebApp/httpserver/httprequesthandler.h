@@ -19,6 +19,13 @@ namespace stefanfrings {
    <p>
    You need to override the service() method or you will always get an HTTP error 501.
    <p>
+   Large request bodies can be received in blocks instead of being collected in memory.
+   To do so, override headersReceived() to return true for the requests of interest,
+   and receiveBody() to consume the blocks. The service() method is called after the
+   last block has been received, HttpRequest::getBody() is empty then.
+   <p>
+   Override warmUp() to fill caches at startup, before the first requests arrive.
+   <p>
    @warning Be aware that the main request handler instance must be created on the heap and
    that it is used by multiple threads simultaneously.
    @see StaticFileController which delivers static local files.
@@ -46,6 +53,52 @@ public:
      */
     virtual void service( HttpRequest& request, HttpResponse& response );
 
+    /**
+       Called when the headers of a request have been received, before the body.
+       The default implementation returns false, so the whole body is collected
+       and available by HttpRequest::getBody().
+       <p>
+       This method may also install a HttpUploadSink by HttpRequest::setUploadSink()
+       to receive uploaded files of multipart/form-data requests.
+       @param request The request, only the request line and headers are available
+       @return true to receive the body by receiveBody(). Multipart bodies are
+       always parsed by the HttpRequest, so the result is ignored for them.
+       @warning This method must be thread safe. It is called by the thread that
+       reads the socket, so it should not block for long in reactor mode.
+     */
+    virtual bool headersReceived( HttpRequest& request );
+
+    /**
+       Receive the next block of a request body, if headersReceived() returned true.
+       @param request The request, only the request line and headers are available
+       @param data The received bytes
+       @param size Number of received bytes
+       @return false to abort the request, the client then gets an error response with status 400,
+       or the status set by HttpRequest::setAbortStatus()
+       @warning This method must be thread safe. It is called by the thread that
+       reads the socket, so it should not block for long in reactor mode.
+     */
+    virtual bool receiveBody( HttpRequest& request, const char* data, const int size );
+
+    /**
+       Load caches before the server gets busy, called by the HttpListener at startup
+       depending on the warmUp setting. The default implementation does nothing.
+       A central request handler should forward the call to its StaticFileController
+       and other caching controllers.
+       @warning This method must be thread safe. In background mode it runs while
+       requests are already being serviced.
+     */
+    virtual void warmUp();
+
+signals:
+
+    /**
+       Emitted while warmUp() is loading files, maybe by other threads.
+       @param done Number of files loaded so far
+       @param total Number of files to load
+     */
+    void warmUpProgress( int done, int total );
+
 };
 
 } // end of namespace
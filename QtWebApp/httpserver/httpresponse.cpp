@@ -4,6 +4,22 @@
  */
 
 #include "httpresponse.h"
+#include <QAtomicInt>
+#include <QUuid>
+#ifndef QT_NO_SSL
+    #include <QSslSocket>
+#endif
+#if defined( Q_OS_UNIX )
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <errno.h>
+    #include <string.h>
+#endif
+#if defined( Q_OS_LINUX )
+    #include <sys/sendfile.h>
+    #include <signal.h>
+#endif
 
 using namespace stefanfrings;
 
@@ -13,7 +29,34 @@ HttpResponse::HttpResponse( QTcpSocket* socket ) :
     m_statusText( "OK" ),
     m_sentHeaders( false ),
     m_sentLastPart( false ),
-    m_chunkedMode( false ) {}
+    m_chunkedMode( false ),
+    m_highWatermark( 65536 ),
+    m_blocking( false ),
+    m_writeTimeout( 30000 ),
+    m_compression( HttpCompressor::IDENTITY ),
+    m_compressMinSize( 0 ),
+    m_compressLevel( 6 ),
+    m_compressor( nullptr ) {}
+
+HttpResponse::HttpResponse( QTcpSocket* socket, const HttpServerConfig* config ) :
+    m_socket( socket ),
+    m_statusCode( 200 ),
+    m_statusText( "OK" ),
+    m_sentHeaders( false ),
+    m_sentLastPart( false ),
+    m_chunkedMode( false ),
+    m_highWatermark( config->writeHighWatermark ),
+    m_blocking( false ),
+    m_writeTimeout( config->readTimeout ),
+    m_compression( HttpCompressor::IDENTITY ),
+    m_compressMinSize( config->compressMinSize ),
+    m_compressLevel( config->compressLevel ),
+    m_compressor( nullptr ) {}
+
+HttpResponse::~HttpResponse() {
+    clearPending();
+    delete m_compressor;
+}
 
 void HttpResponse::setHeader( const QByteArray& name, const QByteArray& value ) {
     Q_ASSERT( m_sentHeaders == false );
@@ -38,6 +81,44 @@ int HttpResponse::getStatusCode() const {
     return m_statusCode;
 }
 
+void HttpResponse::setCompression( const HttpCompressor::Encoding encoding ) {
+    Q_ASSERT( m_sentHeaders == false );
+    m_compression = encoding;
+}
+
+void HttpResponse::startCompression( const qint64 size, const bool lastPart ) {
+    if ( m_compression == HttpCompressor::IDENTITY || m_compressMinSize <= 0 ) {
+        return;
+    }
+    // Responses without body, partial content and bodies that the request handler encoded itself stay as they are.
+    // A strong entity tag identifies the exact bytes, so compression would need a different one.
+    if ( m_statusCode == 204 || m_statusCode == 304 || m_statusCode == 206 || m_headers.contains( "Content-Encoding" )
+         || m_headers.contains( "ETag" ) ) {
+        return;
+    }
+    if ( !HttpCompressor::isCompressible( m_headers.value( "Content-Type" ) ) ) {
+        return;
+    }
+    // Small bodies are not worth it. For streamed bodies, the Content-Length header tells the total size.
+    qint64 totalSize = lastPart ? size : m_headers.value( "Content-Length", "-1" ).toLongLong();
+    if ( ( lastPart || totalSize >= 0 ) && totalSize < m_compressMinSize ) {
+        return;
+    }
+    m_compressor = new HttpCompressor( m_compression, m_compressLevel );
+    if ( !m_compressor->isValid() ) {
+        // Send the body uncompressed
+        delete m_compressor;
+        m_compressor = nullptr;
+        return;
+    }
+    m_headers.remove( "Content-Length" );
+    m_headers.insert( "Content-Encoding", HttpCompressor::name( m_compression ) );
+    m_headers.insert( "Vary", "Accept-Encoding" );
+#ifdef SUPERVERBOSE
+    qDebug( "HttpResponse: compressing body with %s", HttpCompressor::name( m_compression ).data() );
+#endif
+}
+
 void HttpResponse::writeHeaders() {
     Q_ASSERT( m_sentHeaders == false );
     QByteArray buffer;
@@ -46,11 +127,18 @@ void HttpResponse::writeHeaders() {
     buffer.append( ' ' );
     buffer.append( m_statusText );
     buffer.append( "\r\n" );
+    buffer.append( serializeHeaders() );
+    buffer.append( "\r\n" );
+    appendData( buffer );
+    m_sentHeaders = true;
+}
 
+QByteArray HttpResponse::serializeHeaders() const {
+    QByteArray buffer;
     for ( auto header = m_headers.cbegin(); header != m_headers.cend(); ++header ) {
         buffer.append( header.key() );
         buffer.append( ": " );
-        buffer.append( m_headers.value( header.key() ) );
+        buffer.append( header.value() );
         buffer.append( "\r\n" );
 
     }
@@ -60,80 +148,411 @@ void HttpResponse::writeHeaders() {
         buffer.append( cookie.value().toByteArray() );
         buffer.append( "\r\n" );
     }
-
-    buffer.append( "\r\n" );
-    writeToSocket( buffer );
-    m_socket->flush();
-    m_sentHeaders = true;
+    return buffer;
 }
 
-bool HttpResponse::writeToSocket( const QByteArray& data ) const {
-    int remaining = data.size();
-    const char* ptr = data.data();
-    while ( m_socket->isOpen() && remaining>0 ) {
-        // If the output buffer has become large, then wait until it has been sent.
-        if ( m_socket->bytesToWrite() > 16384 ) {
-            m_socket->waitForBytesWritten( -1 );
-        }
-
-        qint64 written = m_socket->write( ptr, remaining );
-        if ( written == -1 ) {
-            return false;
+void HttpResponse::prepareHeaders( const qint64 size, const bool lastPart ) {
+    // If the whole response is generated with a single call to write(), then we know the total
+    // size of the response and therefore can set the Content-Length header automatically.
+    if ( hasNoBody() ) {
+        // These responses never have a body, a Content-Length would describe the omitted content
+        Q_UNUSED( size )
+    } else if ( lastPart ) {
+        // Automatically set the Content-Length header
+        m_headers.insert( "Content-Length", QByteArray::number( size ) );
+    } else if ( !m_headers.contains( "Content-Length" ) ) {
+        // else if we will not close the connection at the end, them we must use the chunked mode.
+        QByteArray connectionValue = m_headers.value( "Connection", m_headers.value( "connection" ) );
+        bool connectionClose = QString::compare( connectionValue, "close", Qt::CaseInsensitive )==0;
+        if ( !connectionClose ) {
+            m_headers.insert( "Transfer-Encoding", "chunked" );
+            m_chunkedMode = true;
         }
-        ptr += written;
-        remaining -= written;
     }
-    return true;
+
+    writeHeaders();
+}
+
+bool HttpResponse::hasNoBody() const {
+    return m_statusCode == 204 || m_statusCode == 304;
 }
 
 void HttpResponse::write( const QByteArray& data, bool lastPart ) {
     Q_ASSERT( m_sentLastPart == false );
 
-    // Send HTTP headers, if not already done (that happens only on the first call to write())
     if ( m_sentHeaders == false ) {
-        // If the whole response is generated with a single call to write(), then we know the total
-        // size of the response and therefore can set the Content-Length header automatically.
-        if ( lastPart ) {
-            // Automatically set the Content-Length header
-            m_headers.insert( "Content-Length", QByteArray::number( data.size() ) );
-        } else {
-            // else if we will not close the connection at the end, them we must use the chunked mode.
-            QByteArray connectionValue = m_headers.value( "Connection", m_headers.value( "connection" ) );
-            bool connectionClose = QString::compare( connectionValue, "close", Qt::CaseInsensitive )==0;
-            if ( !connectionClose ) {
-                m_headers.insert( "Transfer-Encoding", "chunked" );
-                m_chunkedMode = true;
-            }
-        }
+        startCompression( data.size(), lastPart );
+    }
+    QByteArray body = m_compressor ? m_compressor->process( data, lastPart ) : data;
+    if ( hasNoBody() ) {
+        // The client would take the body for the next response on this connection
+        body.clear();
+    }
 
-        writeHeaders();
+    // Send HTTP headers, if not already done (that happens only on the first call to write())
+    if ( m_sentHeaders == false ) {
+        prepareHeaders( body.size(), lastPart );
     }
 
     // Send data
-    if ( data.size() > 0 ) {
+    if ( body.size() > 0 ) {
         if ( m_chunkedMode ) {
-            if ( data.size() > 0 ) {
-                QByteArray size = QByteArray::number( data.size(), 16 );
-                writeToSocket( size );
-                writeToSocket( "\r\n" );
-                writeToSocket( data );
-                writeToSocket( "\r\n" );
-            }
+            QByteArray size = QByteArray::number( body.size(), 16 );
+            size.append( "\r\n" );
+            appendData( size );
+            appendData( body );
+            appendData( QByteArrayLiteral( "\r\n" ) );
         } else {
-            writeToSocket( data );
+            appendData( body );
         }
     }
 
     // Only for the last chunk, send the terminating marker and flush the buffer.
+    if ( lastPart && m_chunkedMode ) {
+        appendData( QByteArrayLiteral( "0\r\n\r\n" ) );
+    }
+    sendPendingOutput();
     if ( lastPart ) {
+        m_socket->flush();
+        m_sentLastPart = true;
+    } else if ( m_blocking && !isWritable() ) {
+        // Let the request handler produce more data only when the client received enough
+        if ( !waitForWritable( m_writeTimeout ) && m_socket->isOpen() ) {
+            qWarning( "HttpResponse: the client does not receive the response, closing the connection" );
+            clearPending();
+            m_socket->abort();
+        }
+    }
+}
+
+void HttpResponse::writeFile( QFile* file, const qint64 offset, const qint64 length, const bool lastPart ) {
+    Q_ASSERT( m_sentLastPart == false );
+    Q_ASSERT( file != nullptr && file->isOpen() );
+    // A compressed stream cannot be continued with uncompressed file content
+    Q_ASSERT( m_compressor == nullptr );
+
+    if ( m_sentHeaders == false ) {
+        prepareHeaders( length, lastPart );
+    }
+
+    QSharedPointer<QFile> shared( file );
+    if ( length > 0 && !hasNoBody() ) {
         if ( m_chunkedMode ) {
-            writeToSocket( "0\r\n\r\n" );
+            QByteArray size = QByteArray::number( length, 16 );
+            size.append( "\r\n" );
+            appendData( size );
+            appendFile( shared, offset, length );
+            appendData( QByteArrayLiteral( "\r\n" ) );
+        } else {
+            appendFile( shared, offset, length );
         }
+    }
+
+    if ( lastPart && m_chunkedMode ) {
+        appendData( QByteArrayLiteral( "0\r\n\r\n" ) );
+    }
+    sendPendingOutput();
+    if ( lastPart ) {
         m_socket->flush();
         m_sentLastPart = true;
     }
 }
 
+void HttpResponse::writeRanges( const QByteArray& document, const QList<HttpRange>& ranges ) {
+    writeRangeParts( document, QSharedPointer<QFile>(), document.size(), ranges );
+}
+
+void HttpResponse::writeFileRanges( QFile* file, const QList<HttpRange>& ranges ) {
+    Q_ASSERT( file != nullptr && file->isOpen() );
+    QSharedPointer<QFile> shared( file );
+    writeRangeParts( QByteArray(), shared, file->size(), ranges );
+}
+
+void HttpResponse::writeRangeParts( const QByteArray& document, const QSharedPointer<QFile>& file, const qint64 size,
+                                    const QList<HttpRange>& ranges ) {
+    Q_ASSERT( m_sentHeaders == false );
+    Q_ASSERT( !ranges.isEmpty() );
+    setStatus( 206, "Partial Content" );
+    if ( ranges.size() == 1 ) {
+        const HttpRange& range = ranges.first();
+        m_headers.insert( "Content-Range", range.contentRange( size ) );
+        prepareHeaders( range.length(), true );
+        if ( file ) {
+            appendFile( file, range.first, range.length() );
+        } else {
+            appendData( document, range.first, range.last + 1 );
+        }
+    } else {
+        // The total size is known in advance, so the parts are sent with a Content-Length
+        QByteArray boundary = QUuid::createUuid().toRfc4122().toHex();
+        QByteArray contentType = m_headers.value( "Content-Type" );
+        QList<QByteArray> partHeaders;
+        qint64 total = 0;
+        for ( const HttpRange& range : ranges ) {
+            QByteArray header = partHeaders.isEmpty() ? "--" : "\r\n--";
+            header.append( boundary );
+            header.append( "\r\n" );
+            if ( !contentType.isEmpty() ) {
+                header.append( "Content-Type: " + contentType + "\r\n" );
+            }
+            header.append( "Content-Range: " + range.contentRange( size ) + "\r\n\r\n" );
+            partHeaders.append( header );
+            total += header.size() + range.length();
+        }
+        QByteArray trailer = "\r\n--" + boundary + "--\r\n";
+        total += trailer.size();
+        m_headers.insert( "Content-Type", "multipart/byteranges; boundary=" + boundary );
+        prepareHeaders( total, true );
+        for ( int i = 0; i < ranges.size(); ++i ) {
+            const HttpRange& range = ranges.at( i );
+            appendData( partHeaders.at( i ) );
+            if ( file ) {
+                appendFile( file, range.first, range.length() );
+            } else {
+                appendData( document, range.first, range.last + 1 );
+            }
+        }
+        appendData( trailer );
+    }
+    sendPendingOutput();
+    m_socket->flush();
+    m_sentLastPart = true;
+}
+
+void HttpResponse::writeSerialized( const QByteArray& serialized, const int headerSize ) {
+    Q_ASSERT( m_sentHeaders == false );
+    Q_ASSERT( headerSize >= 4 && headerSize <= serialized.size() );
+    if ( m_headers.isEmpty() && m_cookies.isEmpty() ) {
+        appendData( serialized );
+    } else {
+        // Insert the additional headers before the empty line
+        appendData( serialized, 0, headerSize - 2 );
+        appendData( serializeHeaders() + "\r\n" );
+        appendData( serialized, headerSize, serialized.size() );
+    }
+    m_headers.insert( "Content-Length", QByteArray::number( serialized.size() - headerSize ) );
+    m_sentHeaders = true;
+    sendPendingOutput();
+    m_socket->flush();
+    m_sentLastPart = true;
+}
+
+bool HttpResponse::hasPendingOutput() const {
+    return !m_pending.isEmpty();
+}
+
+qint64 HttpResponse::bytesPending() const {
+    qint64 bytes = m_socket->bytesToWrite();
+    for ( const Segment& segment : qAsConst( m_pending ) ) {
+        bytes += segment.end - segment.offset;
+    }
+    return bytes;
+}
+
+bool HttpResponse::isWritable() const {
+    return bytesPending() < m_highWatermark;
+}
+
+void HttpResponse::setBlocking( const bool blocking ) {
+    m_blocking = blocking;
+}
+
+bool HttpResponse::waitForWritable( const int msecs ) {
+    sendPendingOutput();
+    while ( !isWritable() ) {
+        if ( m_socket->state() != QAbstractSocket::ConnectedState || !m_socket->waitForBytesWritten( msecs ) ) {
+            return false;
+        }
+        sendPendingOutput();
+    }
+    return true;
+}
+
+void HttpResponse::appendData( const QByteArray& data ) {
+    if ( !data.isEmpty() ) {
+        Segment segment;
+        segment.data = data;
+        segment.offset = 0;
+        segment.end = data.size();
+        m_pending.append( segment );
+    }
+}
+
+void HttpResponse::appendData( const QByteArray& data, const qint64 offset, const qint64 end ) {
+    if ( end > offset ) {
+        Segment segment;
+        segment.data = data;
+        segment.offset = offset;
+        segment.end = end;
+        m_pending.append( segment );
+    }
+}
+
+void HttpResponse::appendFile( const QSharedPointer<QFile>& file, const qint64 offset, const qint64 length ) {
+    Segment segment;
+    segment.file = file;
+    segment.offset = offset;
+    segment.end = offset + length;
+    m_pending.append( segment );
+}
+
+void HttpResponse::clearPending() {
+    m_pending.clear();
+}
+
+void HttpResponse::sendPendingOutput() {
+    if ( !m_socket->isOpen() ) {
+        // The client is gone, nobody will receive the rest
+        clearPending();
+        return;
+    }
+
+    // Pass the leading data directly to the kernel, if nothing else is waiting in the output buffer
+    if ( m_socket->bytesToWrite() == 0 ) {
+        sendDirectly();
+    }
+
+    // Fill the output buffer up to the high watermark, the socket sends it in the background
+    while ( !m_pending.isEmpty() ) {
+        qint64 room = m_highWatermark - m_socket->bytesToWrite();
+        if ( room <= 0 ) {
+            break;
+        }
+        Segment& segment = m_pending.first();
+        qint64 size = qMin( room, segment.end - segment.offset );
+        qint64 written;
+        if ( segment.file ) {
+            // Read the next block of the file
+            size = qMin<qint64>( size, 65536 );
+            QByteArray buffer( int( size ), Qt::Uninitialized );
+            if ( segment.file->pos() != segment.offset ) {
+                segment.file->seek( segment.offset );
+            }
+            qint64 read = segment.file->read( buffer.data(), size );
+            if ( read <= 0 ) {
+                qCritical( "HttpResponse: cannot read file %s", qPrintable( segment.file->fileName() ) );
+                clearPending();
+                m_socket->abort();
+                return;
+            }
+            written = m_socket->write( buffer.constData(), read );
+        } else {
+            written = m_socket->write( segment.data.constData() + segment.offset, size );
+        }
+        if ( written < 0 ) {
+            clearPending();
+            return;
+        }
+        segment.offset += written;
+        if ( segment.offset >= segment.end ) {
+            m_pending.removeFirst();
+        }
+    }
+}
+
+void HttpResponse::sendDirectly() {
+#if defined( Q_OS_UNIX ) && defined( MSG_NOSIGNAL )
+    // Encrypted connections must pass through QSslSocket.
+    if ( m_pending.isEmpty() || m_socket->state() != QAbstractSocket::ConnectedState ) {
+        return;
+    }
+#ifndef QT_NO_SSL
+    if ( qobject_cast<QSslSocket*>( m_socket ) ) {
+        return;
+    }
+#endif
+    const int fd = int( m_socket->socketDescriptor() );
+    if ( fd < 0 ) {
+        return;
+    }
+    while ( !m_pending.isEmpty() ) {
+        if ( m_pending.first().file ) {
+#if defined( Q_OS_LINUX )
+            if ( sendFileDirectly( fd, m_pending.first() ) ) {
+                continue;
+            }
+#endif
+            return;
+        }
+        struct iovec vector[16];
+        int count = 0;
+        for ( int i = 0; i < m_pending.size() && count < 16 && !m_pending.at( i ).file; ++i, ++count ) {
+            const Segment& segment = m_pending.at( i );
+            vector[count].iov_base = const_cast<char*>( segment.data.constData() + segment.offset );
+            vector[count].iov_len = size_t( segment.end - segment.offset );
+        }
+        struct msghdr message;
+        memset( &message, 0, sizeof( message ) );
+        message.msg_iov = vector;
+        message.msg_iovlen = count;
+        ssize_t written = ::sendmsg( fd, &message, MSG_NOSIGNAL );
+        if ( written < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            // EAGAIN or an error, the socket handles the rest
+            return;
+        }
+        // Remove the segments that have been sent
+        while ( written > 0 ) {
+            Segment& segment = m_pending.first();
+            qint64 left = segment.end - segment.offset;
+            if ( written >= left ) {
+                written -= left;
+                m_pending.removeFirst();
+            } else {
+                segment.offset += written;
+                // The kernel buffer is full
+                return;
+            }
+        }
+    }
+#endif
+}
+
+#if defined( Q_OS_LINUX )
+bool HttpResponse::sendFileDirectly( const int fd, Segment& segment ) {
+    // Files without a handle (e.g. Qt resources) are read by sendPendingOutput()
+    const int fileFd = segment.file->handle();
+    if ( fileFd < 0 ) {
+        return false;
+    }
+    // Unlike sendmsg(), sendfile() has no flag to suppress SIGPIPE. Ignore the signal like
+    // QAbstractSocket does, unless the application installed its own handler.
+    static QBasicAtomicInt sigPipeIgnored = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+    if ( !sigPipeIgnored.loadAcquire() ) {
+        struct sigaction previous;
+        memset( &previous, 0, sizeof( previous ) );
+        if ( ::sigaction( SIGPIPE, nullptr, &previous ) == 0 && previous.sa_handler == SIG_DFL ) {
+            struct sigaction ignore;
+            memset( &ignore, 0, sizeof( ignore ) );
+            ignore.sa_handler = SIG_IGN;
+            ::sigaction( SIGPIPE, &ignore, nullptr );
+        }
+        sigPipeIgnored.storeRelease( 1 );
+    }
+    // The kernel copies from the page cache to the socket, without passing the bytes through this process
+    off_t offset = off_t( segment.offset );
+    size_t count = size_t( qMin<qint64>( segment.end - segment.offset, 0x7FFFF000 ) );
+    ssize_t sent = ::sendfile( fd, fileFd, &offset, count );
+    if ( sent < 0 ) {
+        // EINTR: try again. EAGAIN or an error: the socket handles the rest.
+        return errno == EINTR;
+    }
+    if ( sent == 0 ) {
+        // The file became shorter, sendPendingOutput() reports the error
+        return false;
+    }
+    segment.offset += sent;
+    if ( segment.offset < segment.end ) {
+        // The kernel buffer is full
+        return false;
+    }
+    m_pending.removeFirst();
+    return true;
+}
+#endif
+
 bool HttpResponse::hasSentLastPart() const {
     return m_sentLastPart;
 }
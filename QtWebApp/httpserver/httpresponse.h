@@ -6,11 +6,17 @@
 #ifndef HTTPRESPONSE_H
 #define HTTPRESPONSE_H
 
+#include <QFile>
+#include <QList>
 #include <QMap>
+#include <QSharedPointer>
 #include <QString>
 #include <QTcpSocket>
 #include "httpglobal.h"
 #include "httpcookie.h"
+#include "httpcompressor.h"
+#include "httprange.h"
+#include "httpserverconfig.h"
 
 namespace stefanfrings {
 
@@ -31,6 +37,35 @@ namespace stefanfrings {
    <p>
    In case of large responses (e.g. file downloads), a Content-Length header should be set
    before calling write(). Web Browsers use that information to display a progress bar.
+   <p>
+   Each call to write() collects the status line, headers, chunk framing and body as a list
+   of fragments, which refer to the given QByteArrays without copying them. On Unix systems
+   the fragments are passed to the kernel with a single sendmsg() call, if the connection is
+   not encrypted and the output buffer of the socket is empty. Otherwise, or if the kernel
+   does not take all bytes at once, the (remaining) fragments are written to the socket.
+   <p>
+   The output buffer of the socket is filled up to writeHighWatermark bytes, the rest is kept
+   as pending output. After the request handler
+   returned, the HttpConnectionHandler sends the pending output whenever the output buffer
+   drained below writeLowWatermark. Large files should be passed by writeFile(), then they
+   are read in small blocks while being sent instead of being loaded into memory.
+   On Linux, files are passed from the page cache to the socket with sendfile() under the
+   same conditions as sendmsg() above, so their content does not pass through user space.
+   When the kernel buffer is full, the next block is read into the output buffer of the
+   socket instead, so that the socket signals when sending can continue.
+   <p>
+   If blocking has been enabled by setBlocking(), write() waits like the socket based writing
+   of older versions when more than writeHighWatermark bytes are pending, unless it writes the
+   last part. So a request handler that streams a large body with many calls to write() does
+   not keep all of it in memory. If the client does not receive anything within readTimeout,
+   the connection gets closed. The HttpConnectionHandler enables blocking unless the request
+   handler runs in a shared event-loop thread, where write() never waits.
+   <p>
+   If compression has been enabled by setCompression(), the body is compressed on the fly,
+   provided that the Content-Type is compressible and neither Content-Encoding nor ETag has been set.
+   A body that is written with a single call to write() is only compressed if it has at
+   least compressMinSize bytes. Streamed bodies are sent in chunked mode, because their
+   compressed size is unknown in advance. Files passed by writeFile() are never compressed.
  */
 
 class DECLSPEC HttpResponse {
@@ -43,6 +78,16 @@ public:
      */
     explicit HttpResponse( QTcpSocket* socket );
 
+    /**
+       Constructor.
+       @param socket used to write the response
+       @param config Configuration of the HTTP server, provides the writeHighWatermark and compression settings
+     */
+    HttpResponse( QTcpSocket* socket, const HttpServerConfig* config );
+
+    /** Destructor, deletes files of pending output and the compressor */
+    ~HttpResponse();
+
     /**
        Set a HTTP response header.
        You must call this method before the first write().
@@ -74,13 +119,22 @@ public:
     /** Return the status code. */
     int getStatusCode() const;
 
+    /**
+       Compress the body with the given content coding, if it is suitable for compression.
+       Called by the HttpConnectionHandler with the result of HttpCompressor::negotiate().
+       You must call this method before the first write().
+       @param encoding Content coding, IDENTITY disables compression
+     */
+    void setCompression( const HttpCompressor::Encoding encoding );
+
     /**
        Write body data to the socket.
        <p>
        The HTTP status line, headers and cookies are sent automatically before the body.
        <p>
        If the response contains only a single chunk (indicated by lastPart=true),
-       then a Content-Length header is automatically set.
+       then a Content-Length header is automatically set. Except for the status codes
+       204 and 304, which must not have a body. Their body is discarded.
        <p>
        Chunked mode is automatically selected if there is no Content-Length header
        and also no Connection:close header.
@@ -89,6 +143,87 @@ public:
      */
     void write( const QByteArray& data, const bool lastPart = true );
 
+    /**
+       Write a range of a file as body data. Behaves like write(), but the file content is
+       read in small blocks while the client receives it.
+       @param file An opened file, the response takes over ownership
+       @param offset Position of the first byte to send
+       @param length Number of bytes to send
+       @param lastPart Indicates that this is the last chunk of data.
+     */
+    void writeFile( QFile* file, const qint64 offset, const qint64 length, const bool lastPart = true );
+
+    /**
+       Send ranges of a document with status 206, as requested by the Range header.
+       A single range is sent as it is, multiple ranges are sent as multipart/byteranges.
+       The Content-Type header should be set before, it describes the whole document.
+       Completes the response, like write() with lastPart=true.
+       @param document The whole document
+       @param ranges Satisfiable ranges, as returned by HttpRange::parse()
+     */
+    void writeRanges( const QByteArray& document, const QList<HttpRange>& ranges );
+
+    /**
+       Send ranges of a file with status 206. Behaves like writeRanges(), but the file content
+       is read while the client receives it, or passed by sendfile() if possible.
+       @param file An opened file, the response takes over ownership
+       @param ranges Satisfiable ranges, as returned by HttpRange::parse()
+     */
+    void writeFileRanges( QFile* file, const QList<HttpRange>& ranges );
+
+    /**
+       Send a complete response, that has been serialized before, e.g. by a cache.
+       The buffer is referenced and not copied, so a hit of a cache can be sent with a
+       single system call. Headers and cookies that have been set on this response are
+       inserted after the serialized headers, they must not repeat any of them.
+       The Content-Length header of the serialized response is taken over into getHeaders(),
+       so the HttpConnectionHandler knows that the connection can be kept open.
+       Completes the response, like write() with lastPart=true.
+       @param serialized Status line, headers, empty line and body
+       @param headerSize Size of the status line, headers and empty line
+     */
+    void writeSerialized( const QByteArray& serialized, const int headerSize );
+
+    /**
+       Whether a part of the response has not been passed to the socket yet,
+       because the client did not receive the previous data fast enough.
+     */
+    bool hasPendingOutput() const;
+
+    /**
+       Number of bytes that have been written but not been passed to the operating system yet,
+       including the output buffer of the socket.
+     */
+    qint64 bytesPending() const;
+
+    /**
+       Whether less than writeHighWatermark bytes are pending, so the next write() does not
+       increase the memory usage beyond the watermark.
+     */
+    bool isWritable() const;
+
+    /**
+       Wait until the client received enough data that isWritable() returns true.
+       Blocks the calling thread, so it should only be used by request handlers that stream
+       large bodies with many calls to write().
+       @param msecs Timeout in milliseconds
+       @return false if the timeout expired or the connection has been lost
+     */
+    bool waitForWritable( const int msecs = 30000 );
+
+    /**
+       Enable or disable waiting in write() while more than writeHighWatermark bytes are pending.
+       Must not be enabled if the calling thread serves other connections.
+     */
+    void setBlocking( const bool blocking );
+
+    /**
+       Pass pending output to the socket until its output buffer reaches the
+       high watermark. Called by the HttpConnectionHandler when the socket
+       signals that bytes have been written.
+     */
+    void sendPendingOutput();
+
     /**
        Indicates whether the body has been sent completely (write() has been called with lastPart=true).
      */
@@ -145,11 +280,102 @@ private:
     /** Cookies */
     QMap<QByteArray, HttpCookie> m_cookies;
 
-    /** Write raw data to the socket. This method blocks until all bytes have been passed to the TCP buffer */
-    bool writeToSocket( const QByteArray& data ) const;
+    /** Maximum number of bytes in the output buffer of the socket */
+    qint64 m_highWatermark;
+
+    /** Whether write() waits while more than m_highWatermark bytes are pending */
+    bool m_blocking;
+
+    /** Maximum time in msec that write() waits for the client */
+    int m_writeTimeout;
+
+    /** Content coding accepted by the client */
+    HttpCompressor::Encoding m_compression;
+
+    /** Minimum size of a body to be compressed, 0 disables compression */
+    int m_compressMinSize;
+
+    /** Compression level 1-9 */
+    int m_compressLevel;
+
+    /** Compresses the body while it is being written, NULL if not compressed */
+    HttpCompressor* m_compressor;
+
+    /** Part of the output that has not been passed to the socket yet */
+    struct Segment {
+        /** Data bytes, if file is NULL */
+        QByteArray data;
+        /** File to send a range of, shared by the segments of a multipart response */
+        QSharedPointer<QFile> file;
+        /** Position of the next byte to send, within data or file */
+        qint64 offset;
+        /** Position after the last byte to send */
+        qint64 end;
+    };
+
+    /** Output that has not been passed to the socket yet */
+    QList<Segment> m_pending;
+
+    /** Add data to the output, the data is referenced and not copied */
+    void appendData( const QByteArray& data );
+
+    /** Add a part of the data to the output, the data is referenced and not copied */
+    void appendData( const QByteArray& data, const qint64 offset, const qint64 end );
+
+    /** Serialize the headers and cookies, without the status line and without the empty line */
+    QByteArray serializeHeaders() const;
+
+    /** Add a range of a file to the output */
+    void appendFile( const QSharedPointer<QFile>& file, const qint64 offset, const qint64 length );
+
+    /**
+       Sub-procedure of writeRanges() and writeFileRanges().
+       @param document The whole document, if file is NULL
+       @param file The file, if not NULL
+       @param size Size of the document or file
+       @param ranges Satisfiable ranges
+     */
+    void writeRangeParts( const QByteArray& document, const QSharedPointer<QFile>& file, const qint64 size,
+                          const QList<HttpRange>& ranges );
+
+    /** Discard pending output */
+    void clearPending();
+
+    /**
+       Pass the leading data segments of the pending output directly to the kernel
+       with a single system call, if possible.
+     */
+    void sendDirectly();
+
+#if defined( Q_OS_LINUX )
+    /**
+       Send a file segment with sendfile(), sub-procedure of sendDirectly().
+       @param fd Descriptor of the socket
+       @param segment The first segment of the pending output
+       @return true if the segment has been sent completely and removed
+     */
+    bool sendFileDirectly( const int fd, Segment& segment );
+#endif
+
+    /**
+       Decide whether the body gets compressed and set the Content-Encoding header accordingly.
+       @param size Size of the first part of the body
+       @param lastPart Whether the first part is also the last one
+     */
+    void startCompression( const qint64 size, const bool lastPart );
+
+    /** Whether the status code forbids a body (204 and 304) */
+    bool hasNoBody() const;
+
+    /**
+       Set the Content-Length or Transfer-Encoding header and add the headers to the output.
+       @param size Size of the first part of the body
+       @param lastPart Whether the first part is also the last one
+     */
+    void prepareHeaders( const qint64 size, const bool lastPart );
 
     /**
-       Write the response HTTP status and headers to the socket.
+       Add the response HTTP status and headers to the output.
        Calling this method is optional, because writeBody() calls
        it automatically when required.
      */
@@ -0,0 +1,58 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpserverconfig.h"
+
+using namespace stefanfrings;
+
+HttpServerConfig::HttpServerConfig( const QSettings* settings ) :
+    fileName( settings->fileName() ),
+    nativeFormat( settings->format() == QSettings::NativeFormat ),
+    host( settings->value( "host" ).toString() ),
+    port( settings->value( "port" ).toUInt() & 0xFFFF ),
+    acceptThreads( settings->value( "acceptThreads", 0 ).toInt() ),
+    minThreads( settings->value( "minThreads", 1 ).toInt() ),
+    maxThreads( settings->value( "maxThreads", 100 ).toInt() ),
+    reactorThreads( settings->value( "reactorThreads", 0 ).toInt() ),
+    maxConnections( settings->value( "maxConnections", 10000 ).toInt() ),
+    cleanupInterval( settings->value( "cleanupInterval", 1000 ).toInt() ),
+    readTimeout( settings->value( "readTimeout", 10000 ).toInt() ),
+    maxRequestSize( settings->value( "maxRequestSize", "16000" ).toInt() ),
+    maxMultiPartSize( settings->value( "maxMultiPartSize", "1000000" ).toInt() ),
+    maxStreamedBodySize( settings->value( "maxStreamedBodySize", "100000000" ).toLongLong() ),
+    writeHighWatermark( settings->value( "writeHighWatermark", 65536 ).toLongLong() ),
+    writeLowWatermark( settings->value( "writeLowWatermark", 16384 ).toLongLong() ),
+    compressMinSize( settings->value( "compressMinSize", 0 ).toInt() ),
+    compressLevel( settings->value( "compressLevel", 6 ).toInt() ),
+    warmUp( settings->value( "warmUp", "none" ).toString() ),
+    sslKeyFile( settings->value( "sslKeyFile", "" ).toString() ),
+    sslCertFile( settings->value( "sslCertFile", "" ).toString() )
+{}
+
+HttpServerConfigHolder::HttpServerConfigHolder( const QSettings* settings ) :
+    m_current( new HttpServerConfig( settings ) ) {
+
+    Q_ASSERT( settings != nullptr );
+}
+
+HttpServerConfigHolder::~HttpServerConfigHolder() {
+    delete m_current.loadAcquire();
+    qDeleteAll( m_retired );
+}
+
+const HttpServerConfig* HttpServerConfigHolder::get() const {
+    return m_current.loadAcquire();
+}
+
+void HttpServerConfigHolder::reload( const QSettings* settings ) {
+    Q_ASSERT( settings != nullptr );
+    const HttpServerConfig* config = new HttpServerConfig( settings );
+    m_mutex.lock();
+    m_retired.append( m_current.fetchAndStoreOrdered( config ) );
+    m_mutex.unlock();
+#ifdef SUPERVERBOSE
+    qDebug( "HttpServerConfigHolder: configuration reloaded" );
+#endif
+}
@@ -0,0 +1,146 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPSERVERCONFIG_H
+#define HTTPSERVERCONFIG_H
+
+#include <QAtomicPointer>
+#include <QList>
+#include <QMutex>
+#include <QSettings>
+#include <QString>
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/**
+   Typed snapshot of the configuration settings of the HTTP server.
+   The settings are parsed once, so the hot path of the server does not need
+   to call QSettings::value(), which locks and allocates a QVariant for each call.
+   Instances are never modified after construction.
+   @see HttpListener for a description of the settings
+ */
+
+struct DECLSPEC HttpServerConfig {
+
+    /**
+       Constructor, parses the settings.
+       @param settings Configuration settings. Must not be 0.
+     */
+    explicit HttpServerConfig( const QSettings* settings );
+
+    /** File name of the settings, used to resolve relative paths */
+    QString fileName;
+
+    /** Whether the settings are stored in the native format (e.g. the Windows registry) */
+    bool nativeFormat;
+
+    /** Network interface to bind to, empty for any */
+    QString host;
+
+    /** TCP port to listen on */
+    quint16 port;
+
+    /** Number of SO_REUSEPORT accept threads, 0 for a single accept loop */
+    int acceptThreads;
+
+    /** Number of idle connection handlers to keep */
+    int minThreads;
+
+    /** Maximum number of connection handler threads or worker threads in reactor mode */
+    int maxThreads;
+
+    /** Number of event-loop threads in reactor mode, 0 to use one thread per connection */
+    int reactorThreads;
+
+    /** Maximum number of connections in reactor mode */
+    int maxConnections;
+
+    /** Interval of the connection handler clean-up in milliseconds */
+    int cleanupInterval;
+
+    /** Maximum time to wait for a complete HTTP request in milliseconds */
+    int readTimeout;
+
+    /** Maximum size of a HTTP request in bytes */
+    int maxRequestSize;
+
+    /** Maximum size of a multipart/form-data request in bytes */
+    int maxMultiPartSize;
+
+    /** Maximum size of a request body that is streamed to the request handler in bytes */
+    qint64 maxStreamedBodySize;
+
+    /** The output buffer of a connection is filled up to this number of bytes */
+    qint64 writeHighWatermark;
+
+    /** Pending output is passed to the output buffer when it drained below this number of bytes */
+    qint64 writeLowWatermark;
+
+    /** Minimum size of a response body to be compressed in bytes, 0 disables compression */
+    int compressMinSize;
+
+    /** Compression level 1-9 */
+    int compressLevel;
+
+    /** When to warm up the caches of the request handler: none, blocking or background */
+    QString warmUp;
+
+    /** SSL key file, empty if SSL is disabled */
+    QString sslKeyFile;
+
+    /** SSL certificate file, empty if SSL is disabled */
+    QString sslCertFile;
+};
+
+/**
+   Holds the current HttpServerConfig of a server and allows to replace it at runtime.
+   <p>
+   Readers get the current snapshot without any lock. When the configuration is replaced,
+   the previous snapshot is retired but kept until the holder is destroyed, because
+   other threads might still read it. Configuration changes are rare, so this costs
+   only a little memory.
+ */
+
+class DECLSPEC HttpServerConfigHolder {
+    Q_DISABLE_COPY( HttpServerConfigHolder )
+
+public:
+    /**
+       Constructor.
+       @param settings Configuration settings for the initial snapshot. Must not be 0.
+     */
+    explicit HttpServerConfigHolder( const QSettings* settings );
+
+    /** Destructor, deletes the current and all retired snapshots */
+    virtual ~HttpServerConfigHolder();
+
+    /**
+       Get the current snapshot. This method is thread safe and lock-free.
+       The returned snapshot stays valid as long as this holder exists.
+     */
+    const HttpServerConfig* get() const;
+
+    /**
+       Parse the settings again and atomically replace the current snapshot.
+       This method is thread safe.
+       @param settings Configuration settings. Must not be 0.
+     */
+    void reload( const QSettings* settings );
+
+private:
+    /** The current snapshot */
+    QAtomicPointer<const HttpServerConfig> m_current;
+
+    /** Previous snapshots that might still be in use by other threads */
+    QList<const HttpServerConfig*> m_retired;
+
+    /** Used to synchronize concurrent reloads */
+    QMutex m_mutex;
+};
+
+} // end of namespace
+
+#endif // HTTPSERVERCONFIG_H
@@ -5,16 +5,18 @@
 
 #include "httpsession.h"
 #include <QDateTime>
-#include <QUuid>
 
 using namespace stefanfrings;
 
 HttpSession::HttpSession( bool canStore ) {
     if ( canStore ) {
         m_dataPtr = new HttpSessionData();
-        m_dataPtr->refCount=1;
-        m_dataPtr->lastAccess=QDateTime::currentMSecsSinceEpoch();
-        m_dataPtr->id=QUuid::createUuid().toString().toLocal8Bit();
+        m_dataPtr->refCount.storeRelease( 1 );
+        m_dataPtr->modified.storeRelease( 1 );
+        m_dataPtr->lastAccess.storeRelease( QDateTime::currentMSecsSinceEpoch() );
+        m_dataPtr->savedAccess = 0;
+        m_dataPtr->key = HttpSessionId::generate();
+        m_dataPtr->id = m_dataPtr->key.toByteArray();
 #ifdef SUPERVERBOSE
         qDebug( "HttpSession: (constructor) new session %s with refCount=1", m_dataPtr->id.constData() );
 #endif
@@ -23,15 +25,24 @@ HttpSession::HttpSession( bool canStore ) {
     }
 }
 
+HttpSession::HttpSession( const QByteArray& id, const qint64 lastAccess, const QMap<QByteArray, QVariant>& values ) {
+    m_dataPtr = new HttpSessionData();
+    m_dataPtr->refCount.storeRelease( 1 );
+    m_dataPtr->modified.storeRelease( 0 );
+    m_dataPtr->lastAccess.storeRelease( lastAccess );
+    m_dataPtr->savedAccess = lastAccess;
+    m_dataPtr->id = id;
+    m_dataPtr->key = HttpSessionId::fromByteArray( id );
+    m_dataPtr->values = values;
+}
+
 HttpSession::HttpSession( const HttpSession& other ) {
     m_dataPtr = other.m_dataPtr;
     if ( m_dataPtr ) {
-        m_dataPtr->lock.lockForWrite();
-        m_dataPtr->refCount++;
+        m_dataPtr->refCount.ref();
 #ifdef SUPERVERBOSE
-        qDebug( "HttpSession: (constructor) copy session %s refCount=%i", m_dataPtr->id.constData(), m_dataPtr->refCount );
+        qDebug( "HttpSession: (constructor) copy session %s refCount=%i", m_dataPtr->id.constData(), m_dataPtr->refCount.loadAcquire() );
 #endif
-        m_dataPtr->lock.unlock();
     }
 }
 
@@ -39,23 +50,17 @@ HttpSession& HttpSession::operator= ( const HttpSession& other ) {
     HttpSessionData* oldPtr = m_dataPtr;
     m_dataPtr = other.m_dataPtr;
     if ( m_dataPtr ) {
-        m_dataPtr->lock.lockForWrite();
-        m_dataPtr->refCount++;
+        m_dataPtr->refCount.ref();
 #ifdef SUPERVERBOSE
-        qDebug( "HttpSession: (operator=) session %s refCount=%i", m_dataPtr->id.constData(), m_dataPtr->refCount );
+        qDebug( "HttpSession: (operator=) session %s refCount=%i", m_dataPtr->id.constData(), m_dataPtr->refCount.loadAcquire() );
 #endif
-        m_dataPtr->lastAccess=QDateTime::currentMSecsSinceEpoch();
-        m_dataPtr->lock.unlock();
+        m_dataPtr->lastAccess.storeRelease( QDateTime::currentMSecsSinceEpoch() );
     }
     if ( oldPtr ) {
-        int refCount;
-        oldPtr->lock.lockForWrite();
-        refCount = --oldPtr->refCount;
 #ifdef SUPERVERBOSE
-        qDebug( "HttpSession: (operator=) session %s refCount=%i", oldPtr->id.constData(), oldPtr->refCount );
+        qDebug( "HttpSession: (operator=) release session %s", oldPtr->id.constData() );
 #endif
-        oldPtr->lock.unlock();
-        if ( refCount == 0 ) {
+        if ( !oldPtr->refCount.deref() ) {
             qDebug( "HttpSession: deleting old data" );
             delete oldPtr;
         }
@@ -65,14 +70,10 @@ HttpSession& HttpSession::operator= ( const HttpSession& other ) {
 
 HttpSession::~HttpSession() {
     if ( m_dataPtr ) {
-        int refCount;
-        m_dataPtr->lock.lockForWrite();
-        refCount = --m_dataPtr->refCount;
 #ifdef SUPERVERBOSE
-        qDebug( "HttpSession: (destructor) session %s refCount=%i", dataPtr->id.constData(), dataPtr->refCount );
+        qDebug( "HttpSession: (destructor) release session %s", m_dataPtr->id.constData() );
 #endif
-        m_dataPtr->lock.unlock();
-        if ( refCount == 0 ) {
+        if ( !m_dataPtr->refCount.deref() ) {
 #ifdef SUPERVERBOSE
             qDebug( "HttpSession: deleting data" );
 #endif
@@ -98,6 +99,7 @@ void HttpSession::set( const QByteArray& key, const QVariant& value ) {
         m_dataPtr->lock.lockForWrite();
         m_dataPtr->values.insert( key, value );
         m_dataPtr->lock.unlock();
+        m_dataPtr->modified.storeRelease( 1 );
     }
 }
 
@@ -106,6 +108,7 @@ void HttpSession::remove( const QByteArray& key ) {
         m_dataPtr->lock.lockForWrite();
         m_dataPtr->values.remove( key );
         m_dataPtr->lock.unlock();
+        m_dataPtr->modified.storeRelease( 1 );
     }
 }
 
@@ -143,20 +146,15 @@ QMap<QByteArray, QVariant> HttpSession::getAll() const {
 }
 
 qint64 HttpSession::getLastAccess() const {
-    qint64 value = 0;
     if ( m_dataPtr ) {
-        m_dataPtr->lock.lockForRead();
-        value = m_dataPtr->lastAccess;
-        m_dataPtr->lock.unlock();
+        return m_dataPtr->lastAccess.loadAcquire();
     }
 
-    return value;
+    return 0;
 }
 
 void HttpSession::setLastAccess() {
     if ( m_dataPtr ) {
-        m_dataPtr->lock.lockForWrite();
-        m_dataPtr->lastAccess = QDateTime::currentMSecsSinceEpoch();
-        m_dataPtr->lock.unlock();
+        m_dataPtr->lastAccess.storeRelease( QDateTime::currentMSecsSinceEpoch() );
     }
 }
@@ -9,7 +9,9 @@
 #include <QByteArray>
 #include <QVariant>
 #include <QReadWriteLock>
+#include <QAtomicInt>
 #include "httpglobal.h"
+#include "httpsessionid.h"
 
 namespace stefanfrings {
 
@@ -17,6 +19,9 @@ namespace stefanfrings {
    This class stores data for a single HTTP session.
    A session can store any number of key/value pairs. This class uses implicit
    sharing for read and write access. This class is thread safe.
+   <p>
+   Copying a session and accessing the last access time are lock-free, only the
+   key/value pairs are protected by a read/write lock.
    @see HttpSessionStore should be used to create and get instances of this class.
  */
 
@@ -31,6 +36,14 @@ public:
      */
     HttpSession( const bool canStore = false );
 
+    /**
+       Constructor, restores a session that has been stored by a HttpSessionBackend.
+       @param id ID of the session
+       @param lastAccess Timestamp of last access
+       @param values The key/value pairs
+     */
+    HttpSession( const QByteArray& id, const qint64 lastAccess, const QMap<QByteArray, QVariant>& values );
+
     /**
        Copy constructor. Creates another HttpSession object that shares the
        data of the other object.
@@ -91,19 +104,29 @@ public:
     void setLastAccess();
 
 private:
+    friend class HttpSessionStore;
 
     struct HttpSessionData {
 
         /** Unique ID */
         QByteArray id;
 
+        /** Unique ID as fixed size key, null if the ID of a restored session has an old format */
+        HttpSessionId key;
+
         /** Timestamp of last access, set by the HttpSessionStore */
-        qint64 lastAccess;
+        QAtomicInteger<qint64> lastAccess;
 
         /** Reference counter */
-        int refCount;
+        QAtomicInt refCount;
+
+        /** Set when the values have been changed, reset by the HttpSessionStore when it saves the session */
+        QAtomicInt modified;
+
+        /** Last access time that has been passed to the backend, used only by the thread of the HttpSessionStore */
+        qint64 savedAccess;
 
-        /** Used to synchronize threads */
+        /** Used to synchronize access to the values */
         QReadWriteLock lock;
 
         /** Storage for the key/value pairs; */
@@ -0,0 +1,17 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpsessionbackend.h"
+
+using namespace stefanfrings;
+
+HttpSessionBackend::HttpSessionBackend()
+{}
+
+HttpSessionBackend::~HttpSessionBackend()
+{}
+
+void HttpSessionBackend::sync()
+{}
@@ -0,0 +1,59 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPSESSIONBACKEND_H
+#define HTTPSESSIONBACKEND_H
+
+#include <QList>
+#include <QByteArray>
+#include "httpglobal.h"
+#include "httpsession.h"
+
+namespace stefanfrings {
+
+/**
+   Persistent storage for the sessions of a HttpSessionStore, so they survive a restart.
+   The store loads all sessions once when it is constructed. Afterwards it reports new,
+   modified, renewed and deleted sessions, collected over one cleanup interval, and then calls sync().
+   <p>
+   Implementations must be thread safe because removeSession() can be called by any thread.
+   @see HttpSessionJournal for the default implementation
+ */
+
+class DECLSPEC HttpSessionBackend {
+    Q_DISABLE_COPY( HttpSessionBackend )
+public:
+
+    /** Constructor */
+    HttpSessionBackend();
+
+    /** Destructor */
+    virtual ~HttpSessionBackend();
+
+    /**
+       Load all stored sessions.
+       @return Sessions with their ID, last access time and values, which may be already expired.
+     */
+    virtual QList<HttpSession> load() = 0;
+
+    /** Store a new or modified session including all values */
+    virtual void save( const HttpSession& session ) = 0;
+
+    /** Store the last access time of a session, whose values did not change */
+    virtual void touch( const QByteArray& sessionId, const qint64 lastAccess ) = 0;
+
+    /** Delete a session */
+    virtual void remove( const QByteArray& sessionId ) = 0;
+
+    /**
+       Called after each batch of changes, to write them to the storage and to do housekeeping.
+       The default implementation does nothing.
+     */
+    virtual void sync();
+};
+
+} // end of namespace
+
+#endif // HTTPSESSIONBACKEND_H
@@ -0,0 +1,109 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpsessionid.h"
+#include <QRandomGenerator>
+#include <QThreadStorage>
+#include <cstring>
+
+using namespace stefanfrings;
+
+/** Alphabet of base64url */
+static const char BASE64URL[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/** Number of random bytes per key */
+static const int RANDOM_SIZE = 16;
+
+/** Random bytes of a thread, refilled from the operating system when they are used up */
+struct RandomPool {
+
+    /** Random bytes, enough for 64 keys */
+    quint32 data[256];
+
+    /** Number of bytes that have been used */
+    int used;
+};
+
+/** Pool of each thread, so threads do not have to synchronize */
+static QThreadStorage<RandomPool*> randomPools;
+
+HttpSessionId::HttpSessionId() {
+    memset( m_data, 0, SIZE );
+}
+
+HttpSessionId HttpSessionId::generate() {
+    if ( !randomPools.hasLocalData() ) {
+        RandomPool* pool = new RandomPool;
+        pool->used = sizeof( pool->data );
+        randomPools.setLocalData( pool );
+    }
+    RandomPool* pool = randomPools.localData();
+    if ( pool->used + RANDOM_SIZE > int( sizeof( pool->data ) ) ) {
+        QRandomGenerator::system()->fillRange( pool->data );
+        pool->used = 0;
+    }
+    const uchar* random = reinterpret_cast<const uchar*>( pool->data ) + pool->used;
+    HttpSessionId key;
+    // Encode 5 groups of 3 bytes with 4 characters each, then the last byte with 2 characters
+    char* out = key.m_data;
+    for ( int i = 0; i < 15; i += 3 ) {
+        quint32 bits = ( quint32( random[i] ) << 16 ) | ( quint32( random[i + 1] ) << 8 ) | random[i + 2];
+        *out++ = BASE64URL[( bits >> 18 ) & 63];
+        *out++ = BASE64URL[( bits >> 12 ) & 63];
+        *out++ = BASE64URL[( bits >> 6 ) & 63];
+        *out++ = BASE64URL[bits & 63];
+    }
+    *out++ = BASE64URL[random[15] >> 2];
+    *out++ = BASE64URL[( random[15] & 3 ) << 4];
+    // Used bytes are wiped, so they cannot leak into another key
+    memset( reinterpret_cast<uchar*>( pool->data ) + pool->used, 0, RANDOM_SIZE );
+    pool->used += RANDOM_SIZE;
+    return key;
+}
+
+HttpSessionId HttpSessionId::fromByteArray( const QByteArray& id ) {
+    HttpSessionId key;
+    if ( id.size() != SIZE ) {
+        return key;
+    }
+    for ( int i = 0; i < SIZE; ++i ) {
+        char c = id.at( i );
+        if ( !( ( c >= 'A' && c <= 'Z' ) || ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ) || c == '-' || c == '_' ) ) {
+            return HttpSessionId();
+        }
+        key.m_data[i] = c;
+    }
+    return key;
+}
+
+bool HttpSessionId::isNull() const {
+    return m_data[0] == 0;
+}
+
+const char* HttpSessionId::constData() const {
+    return m_data;
+}
+
+QByteArray HttpSessionId::toByteArray() const {
+    if ( isNull() ) {
+        return QByteArray();
+    }
+    return QByteArray( m_data, SIZE );
+}
+
+bool HttpSessionId::operator== ( const HttpSessionId& other ) const {
+    return memcmp( m_data, other.m_data, SIZE ) == 0;
+}
+
+bool HttpSessionId::operator!= ( const HttpSessionId& other ) const {
+    return !( *this == other );
+}
+
+tHashValue stefanfrings::qHash( const HttpSessionId& key, tHashValue seed ) {
+    // The characters are random, so the first 8 of them are a good hash value
+    quint64 value;
+    memcpy( &value, key.constData(), sizeof( value ) );
+    return tHashValue( value ^ ( value >> 32 ) ) ^ seed;
+}
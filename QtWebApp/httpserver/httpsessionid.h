@@ -0,0 +1,73 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPSESSIONID_H
+#define HTTPSESSIONID_H
+
+#include <QByteArray>
+#include "httpglobal.h"
+
+namespace stefanfrings {
+
+/** Alias type definition for hash values, for compatibility to different Qt versions */
+#if QT_VERSION >= QT_VERSION_CHECK( 6, 0, 0 )
+typedef size_t tHashValue;
+#else
+typedef uint tHashValue;
+#endif
+
+/**
+   Fixed size key of a HTTP session, 128 random bits encoded as 22 characters base64url.
+   <p>
+   The random bits are taken from a per-thread pool, which is filled from the
+   cryptographically secure random generator of the operating system.
+   Generating, hashing and comparing keys does not allocate memory.
+ */
+
+class DECLSPEC HttpSessionId {
+public:
+
+    /** Number of characters */
+    static const int SIZE = 22;
+
+    /** Constructor, creates a null key */
+    HttpSessionId();
+
+    /** Generate a new random key. This method is thread safe. */
+    static HttpSessionId generate();
+
+    /**
+       Convert a session ID, usually from a cookie, into a key.
+       @return Null key if the ID has the wrong size or contains other characters than base64url.
+     */
+    static HttpSessionId fromByteArray( const QByteArray& id );
+
+    /** Whether this is a null key */
+    bool isNull() const;
+
+    /** The characters of the key, not null terminated */
+    const char* constData() const;
+
+    /** Convert the key to a session ID */
+    QByteArray toByteArray() const;
+
+    /** Compare two keys */
+    bool operator== ( const HttpSessionId& other ) const;
+
+    /** Compare two keys */
+    bool operator!= ( const HttpSessionId& other ) const;
+
+private:
+
+    /** The characters, all zero for a null key */
+    char m_data[SIZE];
+};
+
+/** Hash function for QHash and QSet */
+DECLSPEC tHashValue qHash( const HttpSessionId& key, tHashValue seed = 0 );
+
+} // end of namespace
+
+#endif // HTTPSESSIONID_H
@@ -0,0 +1,310 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#include "httpsessionjournal.h"
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+using namespace stefanfrings;
+
+/** Identifies the file format */
+static const char MAGIC[] = "QtWebApp session journal 1\n";
+
+/** Size of the file format identifier */
+static const int MAGIC_SIZE = sizeof( MAGIC ) - 1;
+
+/** Size of the record header, which contains the payload size (32 bit) and checksum (16 bit) */
+static const int HEADER_SIZE = 6;
+
+/** Format of the payload, fixed so the journal remains readable after a Qt upgrade */
+static const QDataStream::Version STREAM_VERSION = QDataStream::Qt_5_6;
+
+/** CRC-16 of a payload, for compatibility to different Qt versions */
+static quint16 checksum( const char* data, const qsizetype size ) {
+#if QT_VERSION >= QT_VERSION_CHECK( 6, 0, 0 )
+    return qChecksum( QByteArrayView( data, size ) );
+#else
+    return qChecksum( data, uint( size ) );
+#endif
+}
+
+/** Prepend the header to a payload */
+static QByteArray frame( const QByteArray& payload ) {
+    QByteArray record( HEADER_SIZE, Qt::Uninitialized );
+    qToLittleEndian<quint32>( quint32( payload.size() ), record.data() );
+    qToLittleEndian<quint16>( checksum( payload.constData(), payload.size() ), record.data() + 4 );
+    record.append( payload );
+    return record;
+}
+
+HttpSessionJournal::HttpSessionJournal( const QString& fileName, const qint64 compactionSize ) :
+    m_fileName( fileName ),
+    m_fileSize( 0 ),
+    m_liveSize( 0 ),
+    m_garbageSize( 0 ),
+    m_compactionSize( compactionSize )
+{}
+
+HttpSessionJournal::~HttpSessionJournal() {
+    QMutexLocker locker( &m_mutex );
+    flush();
+    m_file.close();
+}
+
+bool HttpSessionJournal::open() {
+    m_file.setFileName( m_fileName );
+    if ( !m_file.open( QIODevice::ReadWrite | QIODevice::Append ) ) {
+        qCritical( "HttpSessionJournal: Cannot open %s: %s", qPrintable( m_fileName ), qPrintable( m_file.errorString() ) );
+        return false;
+    }
+    return true;
+}
+
+QList<HttpSession> HttpSessionJournal::load() {
+    QMutexLocker locker( &m_mutex );
+    QList<HttpSession> sessions;
+    m_live.clear();
+    m_liveSize = 0;
+    m_garbageSize = 0;
+    m_buffer.clear();
+    m_file.close();
+    if ( !open() ) {
+        return sessions;
+    }
+    qint64 size = m_file.size();
+    if ( size == 0 ) {
+        m_file.write( MAGIC, MAGIC_SIZE );
+        m_file.flush();
+        m_fileSize = MAGIC_SIZE;
+        return sessions;
+    }
+    uchar* map = m_file.map( 0, size );
+    if ( !map ) {
+        qCritical( "HttpSessionJournal: Cannot map %s: %s", qPrintable( m_fileName ), qPrintable( m_file.errorString() ) );
+        m_file.close();
+        return sessions;
+    }
+    if ( size < MAGIC_SIZE || memcmp( map, MAGIC, MAGIC_SIZE ) != 0 ) {
+        qCritical( "HttpSessionJournal: %s is not a session journal", qPrintable( m_fileName ) );
+        m_file.unmap( map );
+        m_file.close();
+        return sessions;
+    }
+
+    // Find the last PUT record of each session, without deserializing the values
+    qint64 pos = MAGIC_SIZE;
+    while ( pos + HEADER_SIZE <= size ) {
+        const char* data = reinterpret_cast<const char*>( map + pos );
+        quint32 payloadSize = qFromLittleEndian<quint32>( data );
+        quint16 expectedChecksum = qFromLittleEndian<quint16>( data + 4 );
+        if ( payloadSize > quint64( size - pos - HEADER_SIZE )
+             || checksum( data + HEADER_SIZE, qsizetype( payloadSize ) ) != expectedChecksum ) {
+            break;
+        }
+        QByteArray payload = QByteArray::fromRawData( data + HEADER_SIZE, int( payloadSize ) );
+        QDataStream stream( payload );
+        stream.setVersion( STREAM_VERSION );
+        quint8 type = 0;
+        QByteArray sessionId;
+        qint64 lastAccess = 0;
+        stream >> type >> sessionId;
+        if ( type == PUT || type == TOUCH ) {
+            stream >> lastAccess;
+        }
+        if ( stream.status() != QDataStream::Ok ) {
+            break;
+        }
+        int recordSize = HEADER_SIZE + int( payloadSize );
+        QHash<QByteArray, Location>::iterator it = m_live.find( sessionId );
+        if ( type == PUT ) {
+            if ( it != m_live.end() ) {
+                m_garbageSize += it->size;
+                m_liveSize -= it->size;
+            }
+            m_live.insert( sessionId, Location {pos, recordSize, lastAccess, false} );
+            m_liveSize += recordSize;
+        } else if ( type == TOUCH ) {
+            if ( it != m_live.end() ) {
+                it->lastAccess = lastAccess;
+                it->touched = true;
+            }
+            m_garbageSize += recordSize;
+        } else if ( type == REMOVE ) {
+            if ( it != m_live.end() ) {
+                m_garbageSize += it->size;
+                m_liveSize -= it->size;
+                m_live.erase( it );
+            }
+            m_garbageSize += recordSize;
+        } else {
+            break;
+        }
+        pos += recordSize;
+    }
+
+    // Deserialize the live sessions
+    sessions.reserve( m_live.size() );
+    for ( QHash<QByteArray, Location>::const_iterator it = m_live.constBegin(); it != m_live.constEnd(); ++it ) {
+        QByteArray payload = QByteArray::fromRawData( reinterpret_cast<const char*>( map + it->offset + HEADER_SIZE ),
+                                                      it->size - HEADER_SIZE );
+        QDataStream stream( payload );
+        stream.setVersion( STREAM_VERSION );
+        quint8 type;
+        QByteArray sessionId;
+        qint64 lastAccess;
+        QMap<QByteArray, QVariant> values;
+        stream >> type >> sessionId >> lastAccess >> values;
+        sessions.append( HttpSession( it.key(), it->lastAccess, values ) );
+    }
+    m_file.unmap( map );
+
+    if ( pos < size ) {
+        // The process probably died while writing the last record
+        qWarning( "HttpSessionJournal: Discarding %lli damaged bytes at the end of %s", size - pos, qPrintable( m_fileName ) );
+        m_file.resize( pos );
+    }
+    m_fileSize = pos;
+    qDebug( "HttpSessionJournal: Loaded %i sessions from %s", sessions.size(), qPrintable( m_fileName ) );
+    return sessions;
+}
+
+QByteArray HttpSessionJournal::record( const RecordType type, const QByteArray& sessionId, const qint64 lastAccess ) {
+    QByteArray payload;
+    QDataStream stream( &payload, QIODevice::WriteOnly );
+    stream.setVersion( STREAM_VERSION );
+    stream << quint8( type ) << sessionId;
+    if ( type == TOUCH ) {
+        stream << lastAccess;
+    }
+    return frame( payload );
+}
+
+qint64 HttpSessionJournal::append( const QByteArray& data ) {
+    qint64 offset = m_fileSize + m_buffer.size();
+    m_buffer.append( data );
+    return offset;
+}
+
+void HttpSessionJournal::save( const HttpSession& session ) {
+    QByteArray payload;
+    QDataStream stream( &payload, QIODevice::WriteOnly );
+    stream.setVersion( STREAM_VERSION );
+    qint64 lastAccess = session.getLastAccess();
+    stream << quint8( PUT ) << session.getId() << lastAccess << session.getAll();
+    QByteArray put = frame( payload );
+
+    QMutexLocker locker( &m_mutex );
+    if ( !m_file.isOpen() ) {
+        // The journal is not available, the records would pile up in the buffer
+        return;
+    }
+    QHash<QByteArray, Location>::iterator it = m_live.find( session.getId() );
+    if ( it != m_live.end() ) {
+        m_garbageSize += it->size;
+        m_liveSize -= it->size;
+    }
+    m_live.insert( session.getId(), Location {append( put ), int( put.size() ), lastAccess, false} );
+    m_liveSize += put.size();
+}
+
+void HttpSessionJournal::touch( const QByteArray& sessionId, const qint64 lastAccess ) {
+    QMutexLocker locker( &m_mutex );
+    QHash<QByteArray, Location>::iterator it = m_live.find( sessionId );
+    if ( !m_file.isOpen() || it == m_live.end() || it->lastAccess == lastAccess ) {
+        return;
+    }
+    QByteArray touch = record( TOUCH, sessionId, lastAccess );
+    append( touch );
+    it->lastAccess = lastAccess;
+    it->touched = true;
+    m_garbageSize += touch.size();
+}
+
+void HttpSessionJournal::remove( const QByteArray& sessionId ) {
+    QMutexLocker locker( &m_mutex );
+    QHash<QByteArray, Location>::iterator it = m_live.find( sessionId );
+    if ( !m_file.isOpen() || it == m_live.end() ) {
+        return;
+    }
+    QByteArray remove = record( REMOVE, sessionId );
+    append( remove );
+    m_garbageSize += it->size + remove.size();
+    m_liveSize -= it->size;
+    m_live.erase( it );
+}
+
+void HttpSessionJournal::flush() {
+    if ( !m_file.isOpen() ) {
+        m_buffer.clear();
+        return;
+    }
+    if ( m_buffer.isEmpty() ) {
+        return;
+    }
+    qint64 written = m_file.write( m_buffer );
+    m_file.flush();
+    if ( written != m_buffer.size() ) {
+        qCritical( "HttpSessionJournal: Cannot write to %s: %s", qPrintable( m_fileName ), qPrintable( m_file.errorString() ) );
+    }
+    m_fileSize += m_buffer.size();
+    m_buffer.clear();
+}
+
+void HttpSessionJournal::sync() {
+    QMutexLocker locker( &m_mutex );
+    flush();
+    if ( m_garbageSize > m_compactionSize && m_garbageSize > m_liveSize ) {
+        compact();
+    }
+}
+
+void HttpSessionJournal::compact() {
+    if ( !m_file.isOpen() ) {
+        return;
+    }
+    uchar* map = m_file.map( 0, m_fileSize );
+    if ( !map ) {
+        qCritical( "HttpSessionJournal: Cannot map %s: %s", qPrintable( m_fileName ), qPrintable( m_file.errorString() ) );
+        return;
+    }
+    QSaveFile out( m_fileName );
+    if ( !out.open( QIODevice::WriteOnly ) ) {
+        qCritical( "HttpSessionJournal: Cannot create %s: %s", qPrintable( m_fileName ), qPrintable( out.errorString() ) );
+        m_file.unmap( map );
+        return;
+    }
+    // Copy the PUT records, followed by a TOUCH record if the last access time has changed since
+    QHash<QByteArray, Location> live = m_live;
+    qint64 pos = MAGIC_SIZE;
+    qint64 garbageSize = 0;
+    out.write( MAGIC, MAGIC_SIZE );
+    for ( QHash<QByteArray, Location>::iterator it = live.begin(); it != live.end(); ++it ) {
+        out.write( reinterpret_cast<const char*>( map + it->offset ), it->size );
+        it->offset = pos;
+        pos += it->size;
+        if ( it->touched ) {
+            QByteArray touch = record( TOUCH, it.key(), it->lastAccess );
+            out.write( touch );
+            pos += touch.size();
+            garbageSize += touch.size();
+        }
+    }
+    m_file.unmap( map );
+    m_file.close();
+    if ( !out.commit() ) {
+        qCritical( "HttpSessionJournal: Cannot write %s: %s", qPrintable( m_fileName ), qPrintable( out.errorString() ) );
+        open();
+        return;
+    }
+#ifdef SUPERVERBOSE
+    qDebug( "HttpSessionJournal: Compacted %s from %lli to %lli bytes", qPrintable( m_fileName ), m_fileSize, pos );
+#endif
+    m_live = live;
+    m_fileSize = pos;
+    m_garbageSize = garbageSize;
+    open();
+}
@@ -0,0 +1,125 @@
+/**
+   @file
+   @author Stefan Frings
+ */
+
+#ifndef HTTPSESSIONJOURNAL_H
+#define HTTPSESSIONJOURNAL_H
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include "httpglobal.h"
+#include "httpsessionbackend.h"
+
+namespace stefanfrings {
+
+/**
+   Stores sessions in an append-only journal file.
+   <p>
+   Each change of a session is appended as a record with a checksum. The records are collected
+   in memory and written by sync(), so the file gets one write per cleanup interval.
+   After a crash, a truncated or damaged record at the end of the file is discarded.
+   <p>
+   Because old records become obsolete, sync() compacts the journal when the obsolete records
+   are larger than the live ones and larger than compactionSize. The compaction copies the last
+   record of each live session from the memory mapped journal into a new file, which then
+   replaces the old one atomically.
+   <p>
+   On startup, the journal is memory mapped and scanned once to find the last record of each
+   session, only those are deserialized.
+   <p>
+   If the journal cannot be opened, or the file is not a journal, sessions are not stored.
+ */
+
+class DECLSPEC HttpSessionJournal : public HttpSessionBackend {
+    Q_DISABLE_COPY( HttpSessionJournal )
+public:
+
+    /**
+       Constructor.
+       @param fileName Name of the journal file, it is created if it does not exist.
+       @param compactionSize Minimum size of obsolete records in bytes, before the journal gets compacted
+     */
+    HttpSessionJournal( const QString& fileName, const qint64 compactionSize = 1048576 );
+
+    /** Destructor, writes pending changes */
+    virtual ~HttpSessionJournal();
+
+    QList<HttpSession> load() override;
+
+    void save( const HttpSession& session ) override;
+
+    void touch( const QByteArray& sessionId, const qint64 lastAccess ) override;
+
+    void remove( const QByteArray& sessionId ) override;
+
+    void sync() override;
+
+private:
+
+    /** Types of records */
+    enum RecordType {PUT = 1, TOUCH = 2, REMOVE = 3};
+
+    /** Location of the last PUT record of a live session */
+    struct Location {
+
+        /** Position of the record in the journal */
+        qint64 offset;
+
+        /** Size of the record including its header */
+        int size;
+
+        /** Last access time, may be newer than the one in the PUT record */
+        qint64 lastAccess;
+
+        /** Whether TOUCH records follow the PUT record */
+        bool touched;
+    };
+
+    /** Create a TOUCH or REMOVE record */
+    static QByteArray record( const RecordType type, const QByteArray& sessionId, const qint64 lastAccess = 0 );
+
+    /** Append a record to the write buffer and return its position in the journal */
+    qint64 append( const QByteArray& data );
+
+    /** Write the buffer to the file */
+    void flush();
+
+    /** Open the journal file, create it if necessary */
+    bool open();
+
+    /** Replace the journal by a new one that contains only the live sessions */
+    void compact();
+
+    /** Name of the journal file */
+    QString m_fileName;
+
+    /** The journal file */
+    QFile m_file;
+
+    /** Records that have not been written yet */
+    QByteArray m_buffer;
+
+    /** Size of the file, without the buffer */
+    qint64 m_fileSize;
+
+    /** Live sessions */
+    QHash<QByteArray, Location> m_live;
+
+    /** Total size of the live PUT records */
+    qint64 m_liveSize;
+
+    /** Total size of obsolete records */
+    qint64 m_garbageSize;
+
+    /** Minimum size of obsolete records before compaction */
+    qint64 m_compactionSize;
+
+    /** Used to synchronize threads */
+    QMutex m_mutex;
+};
+
+} // end of namespace
+
+#endif // HTTPSESSIONJOURNAL_H
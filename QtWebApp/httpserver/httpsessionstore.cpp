@@ -4,122 +4,339 @@
  */
 
 #include "httpsessionstore.h"
+#include "httpsessionjournal.h"
 #include <QDateTime>
-#include <QUuid>
+#include <QDir>
+#include <QFileInfo>
 
 using namespace stefanfrings;
 
-HttpSessionStore::HttpSessionStore( const QSettings* settings, QObject* parent ) :
+HttpSessionStore::HttpSessionStore( const QSettings* settings, QObject* parent, HttpSessionBackend* backend ) :
     QObject( parent ),
-    m_settings( settings ),
+    m_shards( nullptr ),
+    m_shardCount( qMax( 1, settings->value( "sessionShards", 16 ).toInt() ) ),
     m_cookieName( settings->value( "cookieName", "sessionid" ).toByteArray() ),
-    m_expirationTime( settings->value( "expirationTime", 3600000 ).toInt() ) {
+    m_cookiePath( settings->value( "cookiePath" ).toByteArray() ),
+    m_cookieComment( settings->value( "cookieComment" ).toByteArray() ),
+    m_cookieDomain( settings->value( "cookieDomain" ).toByteArray() ),
+    m_expirationTime( settings->value( "expirationTime", 3600000 ).toInt() ),
+    m_cleanupInterval( qMax( 1, settings->value( "cleanupInterval", 1000 ).toInt() ) ),
+    m_backend( backend ) {
 
+    // A session expires at most expirationTime+cleanupInterval after now. Long expiration times
+    // would need a huge ring, so it is limited and sessions may stay in their bucket for several rounds.
+    m_wheelSize = int( qMin<qint64>( qint64( m_expirationTime ) / m_cleanupInterval + 2, 4096 ) );
+    m_lastSlot = QDateTime::currentMSecsSinceEpoch() / m_cleanupInterval;
+    m_shards = new Shard[m_shardCount];
+    for ( int i = 0; i < m_shardCount; ++i ) {
+        m_shards[i].wheel.resize( m_wheelSize );
+    }
+    QString journalFile = settings->value( "journalFile" ).toString();
+    if ( !m_backend && !journalFile.isEmpty() ) {
+        // Convert relative path to absolute, based on the directory of the config file.
+        #ifdef Q_OS_WIN32
+        if ( QDir::isRelativePath( journalFile ) && settings->format() != QSettings::NativeFormat )
+        #else
+        if ( QDir::isRelativePath( journalFile ) )
+        #endif
+        {
+            QFileInfo configFile( settings->fileName() );
+            journalFile = QFileInfo( configFile.absolutePath(), journalFile ).absoluteFilePath();
+        }
+        m_backend = new HttpSessionJournal( journalFile );
+    }
+    if ( m_backend ) {
+        loadSessions();
+    }
     connect( &m_cleanupTimer, SIGNAL(timeout()), this, SLOT(sessionTimerEvent()) );
-    m_cleanupTimer.start( 60000 );
+    m_cleanupTimer.start( m_cleanupInterval );
 
 #ifdef SUPERVERBOSE
-    qDebug( "HttpSessionStore: Sessions expire after %i milliseconds", m_expirationTime );
+    qDebug( "HttpSessionStore: Sessions expire after %i milliseconds, using %i shards", m_expirationTime, m_shardCount );
 #endif
 }
 
 HttpSessionStore::~HttpSessionStore() {
     m_cleanupTimer.stop();
+    if ( m_backend ) {
+        for ( int i = 0; i < m_shardCount; ++i ) {
+            saveSessions( m_shards[i], QList<QByteArray>(), true );
+        }
+        m_backend->sync();
+        delete m_backend;
+    }
+    delete[] m_shards;
 }
 
-QByteArray HttpSessionStore::getSessionId( const HttpRequest& request, HttpResponse& response ) {
+void HttpSessionStore::loadSessions() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QList<HttpSession> stored = m_backend->load();
+    for ( const HttpSession& session : stored ) {
+        if ( ( now - session.getLastAccess() ) > m_expirationTime ) {
+            m_backend->remove( session.getId() );
+            continue;
+        }
+        const HttpSessionId& key = session.m_dataPtr->key;
+        if ( key.isNull() ) {
+            // The ID has been created by an older version
+            m_backend->remove( session.getId() );
+            continue;
+        }
+        Shard& s = shard( key );
+        // Assigning a session would renew its last access time
+        QHash<HttpSessionId, Entry>::iterator it = s.sessions.insert( key, Entry( session ) );
+        schedule( s, key, it.value() );
+    }
+    m_backend->sync();
+}
+
+void HttpSessionStore::saveSessions( Shard& shard, const QList<QByteArray>& expired, const bool exact ) {
+    for ( const QByteArray& sessionId : expired ) {
+        m_backend->remove( sessionId );
+    }
+    QList<HttpSession> changed;
+    shard.mutex.lock();
+    for ( const HttpSessionId& key : qAsConst( shard.changed ) ) {
+        QHash<HttpSessionId, Entry>::const_iterator it = shard.sessions.constFind( key );
+        if ( it != shard.sessions.constEnd() ) {
+            changed.append( it.value().session );
+        }
+    }
+    shard.changed.clear();
+    shard.mutex.unlock();
+    // The backend is called without holding the lock
+    QList<HttpSessionId> inUse;
+    for ( const HttpSession& session : qAsConst( changed ) ) {
+        HttpSession::HttpSessionData* data = session.m_dataPtr;
+        qint64 lastAccess = data->lastAccess.loadAcquire();
+        if ( data->modified.fetchAndStoreAcquire( 0 ) ) {
+            m_backend->save( session );
+            data->savedAccess = lastAccess;
+        } else if ( exact || lastAccess - data->savedAccess >= m_expirationTime / 16 ) {
+            // Renewals are frequent, writing each of them would flood the backend
+            m_backend->touch( data->id, lastAccess );
+            data->savedAccess = lastAccess;
+        }
+        // The shard and the list hold one reference each, more means that a request may still change it
+        if ( data->refCount.loadAcquire() > 2 || data->modified.loadAcquire() ) {
+            inUse.append( data->key );
+        }
+    }
+    if ( changed.isEmpty() ) {
+        return;
+    }
+    // A session that has been removed by another thread meanwhile must not be restored by the record above
+    QList<QByteArray> removed;
+    shard.mutex.lock();
+    for ( const HttpSession& session : qAsConst( changed ) ) {
+        if ( !shard.sessions.contains( session.m_dataPtr->key ) ) {
+            removed.append( session.getId() );
+        }
+    }
+    for ( const HttpSessionId& key : qAsConst( inUse ) ) {
+        if ( shard.sessions.contains( key ) ) {
+            shard.changed.insert( key );
+        }
+    }
+    shard.mutex.unlock();
+    for ( const QByteArray& sessionId : qAsConst( removed ) ) {
+        m_backend->remove( sessionId );
+    }
+}
+
+HttpSessionStore::Shard& HttpSessionStore::shard( const HttpSessionId& key ) const {
+    // QHash uses the lower bits for its buckets, so the shard is selected by other bits
+    return m_shards[( qHash( key ) >> 16 ) % uint( m_shardCount )];
+}
+
+QByteArray HttpSessionStore::cookieSessionId( const HttpRequest& request, HttpResponse& response ) const {
     // The session ID in the response has priority because this one will be used in the next request.
-    m_mutex.lock();
-    // Get the session ID from the response cookie
     QByteArray sessionId = response.getCookies().value( m_cookieName ).getValue();
     if ( sessionId.isEmpty() ) {
         // Get the session ID from the request cookie
         sessionId = request.getCookie( m_cookieName );
     }
+    return sessionId;
+}
+
+void HttpSessionStore::touch( Shard& shard, const HttpSessionId& key, Entry& entry ) {
+    entry.session.setLastAccess();
+    schedule( shard, key, entry );
+    if ( m_backend ) {
+        shard.changed.insert( key );
+    }
+}
+
+void HttpSessionStore::schedule( Shard& shard, const HttpSessionId& key, Entry& entry ) {
+    // The first slot that begins after the expiry time
+    qint64 slot = ( entry.session.getLastAccess() + m_expirationTime ) / m_cleanupInterval + 1;
+    if ( slot != entry.slot ) {
+        // The ID in the old bucket becomes stale and gets skipped
+        entry.slot = slot;
+        shard.wheel[int( slot % m_wheelSize )].append( key );
+    }
+}
+
+void HttpSessionStore::setSessionCookie( const HttpSession& session, HttpResponse& response ) const {
+    response.setCookie( HttpCookie( m_cookieName, session.getId(), m_expirationTime / 1000,
+                                    m_cookiePath, m_cookieComment, m_cookieDomain, false, false, "Lax" ) );
+}
+
+QByteArray HttpSessionStore::getSessionId( const HttpRequest& request, HttpResponse& response ) {
+    QByteArray sessionId = cookieSessionId( request, response );
     // Clear the session ID if there is no such session in the storage.
     if ( !sessionId.isEmpty() ) {
-        if ( !sessions.contains( sessionId ) ) {
+        HttpSessionId key = HttpSessionId::fromByteArray( sessionId );
+        bool found = false;
+        if ( !key.isNull() ) {
+            Shard& s = shard( key );
+            s.mutex.lock();
+            found = s.sessions.contains( key );
+            s.mutex.unlock();
+        }
+        if ( !found ) {
 #ifdef SUPERVERBOSE
             qDebug( "HttpSessionStore: received invalid session cookie with ID %s", sessionId.data() );
 #endif
             sessionId.clear();
         }
     }
-    m_mutex.unlock();
     return sessionId;
 }
 
 HttpSession HttpSessionStore::getSession( const HttpRequest& request, HttpResponse& response, bool allowCreate ) {
-    QByteArray sessionId = getSessionId( request, response );
-    m_mutex.lock();
-    if ( !sessionId.isEmpty() ) {
-        HttpSession session = sessions.value( sessionId );
+    QByteArray sessionId = cookieSessionId( request, response );
+    HttpSessionId key = HttpSessionId::fromByteArray( sessionId );
+    if ( !key.isNull() ) {
+        Shard& s = shard( key );
+        HttpSession session;
+        s.mutex.lock();
+        QHash<HttpSessionId, Entry>::iterator it = s.sessions.find( key );
+        if ( it != s.sessions.end() ) {
+            touch( s, key, it.value() );
+            session = it.value().session;
+        }
+        s.mutex.unlock();
         if ( !session.isNull() ) {
-            m_mutex.unlock();
             // Refresh the session cookie
-            QByteArray cookieName = m_settings->value( "cookieName", "sessionid" ).toByteArray();
-            QByteArray cookiePath = m_settings->value( "cookiePath" ).toByteArray();
-            QByteArray cookieComment = m_settings->value( "cookieComment" ).toByteArray();
-            QByteArray cookieDomain = m_settings->value( "cookieDomain" ).toByteArray();
-            response.setCookie( HttpCookie( cookieName, session.getId(), m_expirationTime / 1000,
-                                            cookiePath, cookieComment, cookieDomain, false, false, "Lax" ) );
-            session.setLastAccess();
+            setSessionCookie( session, response );
             return session;
         }
     }
+#ifdef SUPERVERBOSE
+    if ( !sessionId.isEmpty() ) {
+        qDebug( "HttpSessionStore: received invalid session cookie with ID %s", sessionId.data() );
+    }
+#endif
     // Need to create a new session
     if ( allowCreate ) {
-        QByteArray cookieName = m_settings->value( "cookieName", "sessionid" ).toByteArray();
-        QByteArray cookiePath = m_settings->value( "cookiePath" ).toByteArray();
-        QByteArray cookieComment = m_settings->value( "cookieComment" ).toByteArray();
-        QByteArray cookieDomain = m_settings->value( "cookieDomain" ).toByteArray();
         HttpSession session( true );
 #ifdef SUPERVERBOSE
         qDebug( "HttpSessionStore: create new session with ID %s", session.getId().data() );
 #endif
-        sessions.insert( session.getId(), session );
-        response.setCookie( HttpCookie( cookieName, session.getId(), m_expirationTime / 1000,
-                                        cookiePath, cookieComment, cookieDomain, false, false, "Lax" ) );
-        m_mutex.unlock();
+        const HttpSessionId& newKey = session.m_dataPtr->key;
+        Shard& s = shard( newKey );
+        s.mutex.lock();
+        QHash<HttpSessionId, Entry>::iterator it = s.sessions.insert( newKey, Entry( session ) );
+        schedule( s, newKey, it.value() );
+        if ( m_backend ) {
+            s.changed.insert( newKey );
+        }
+        s.mutex.unlock();
+        setSessionCookie( session, response );
         return session;
     }
     // Return a null session
-    m_mutex.unlock();
     return HttpSession();
 }
 
 HttpSession HttpSessionStore::getSession( const QByteArray& id ) {
-    m_mutex.lock();
-    HttpSession session = sessions.value( id );
-    m_mutex.unlock();
-    session.setLastAccess();
+    HttpSessionId key = HttpSessionId::fromByteArray( id );
+    if ( key.isNull() ) {
+        return HttpSession();
+    }
+    Shard& s = shard( key );
+    HttpSession session;
+    s.mutex.lock();
+    QHash<HttpSessionId, Entry>::iterator it = s.sessions.find( key );
+    if ( it != s.sessions.end() ) {
+        touch( s, key, it.value() );
+        session = it.value().session;
+    }
+    s.mutex.unlock();
     return session;
 }
 
 void HttpSessionStore::sessionTimerEvent() {
-    m_mutex.lock();
     qint64 now = QDateTime::currentMSecsSinceEpoch();
-    QMap<QByteArray, HttpSession>::iterator i = sessions.begin();
-    while ( i != sessions.end() ) {
-        QMap<QByteArray, HttpSession>::iterator prev = i;
-        ++i;
-        HttpSession session = prev.value();
-        qint64 lastAccess = session.getLastAccess();
-        if ( ( now - lastAccess ) > m_expirationTime ) {
+    qint64 currentSlot = now / m_cleanupInterval;
+    if ( currentSlot <= m_lastSlot ) {
+        return;
+    }
+    // After a long stall, each bucket needs to be processed only once
+    qint64 firstSlot = qMax( m_lastSlot + 1, currentSlot - m_wheelSize + 1 );
+    m_lastSlot = currentSlot;
+    for ( int i = 0; i < m_shardCount; ++i ) {
+        Shard& s = m_shards[i];
+        // The signal is emitted after unlocking, so receivers may access the store
+        QList<QByteArray> expired;
+        s.mutex.lock();
+        for ( qint64 slot = firstSlot; slot <= currentSlot; ++slot ) {
+            int index = int( slot % m_wheelSize );
+            QVector<HttpSessionId> bucket;
+            bucket.swap( s.wheel[index] );
+            for ( const HttpSessionId& key : qAsConst( bucket ) ) {
+                QHash<HttpSessionId, Entry>::iterator it = s.sessions.find( key );
+                if ( it == s.sessions.end() ) {
+                    // Removed session
+                    continue;
+                }
+                Entry& entry = it.value();
+                if ( entry.slot > slot ) {
+                    // Keep sessions of a later round, skip sessions that have been moved to another bucket
+                    if ( entry.slot % m_wheelSize == index ) {
+                        s.wheel[index].append( key );
+                    }
+                    continue;
+                }
+                if ( ( now - entry.session.getLastAccess() ) > m_expirationTime ) {
 #ifdef SUPERVERBOSE
-            qDebug( "HttpSessionStore: session %s expired", session.getId().data() );
+                    qDebug( "HttpSessionStore: session %s expired", entry.session.getId().data() );
 #endif
-            emit sessionDeleted( session.getId() );
-            sessions.erase( prev );
+                    expired.append( entry.session.getId() );
+                    s.sessions.erase( it );
+                } else {
+                    // The session has been accessed without the store, e.g. by HttpSession::setLastAccess()
+                    schedule( s, key, entry );
+                }
+            }
+        }
+        s.mutex.unlock();
+        if ( m_backend ) {
+            saveSessions( s, expired );
+        }
+        for ( const QByteArray& sessionId : qAsConst( expired ) ) {
+            emit sessionDeleted( sessionId );
         }
     }
-    m_mutex.unlock();
+    if ( m_backend ) {
+        m_backend->sync();
+    }
 }
 
 /** Delete a session */
 void HttpSessionStore::removeSession( const HttpSession& session ) {
-    m_mutex.lock();
+    if ( session.isNull() ) {
+        return;
+    }
+    const HttpSessionId& key = session.m_dataPtr->key;
+    Shard& s = shard( key );
+    s.mutex.lock();
+    s.sessions.remove( key );
+    s.changed.remove( key );
+    s.mutex.unlock();
+    if ( m_backend ) {
+        m_backend->remove( session.getId() );
+    }
     emit sessionDeleted( session.getId() );
-    sessions.remove( session.getId() );
-    m_mutex.unlock();
 }
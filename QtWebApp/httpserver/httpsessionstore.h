@@ -7,11 +7,14 @@
 #define HTTPSESSIONSTORE_H
 
 #include <QObject>
-#include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QSet>
 #include <QTimer>
 #include <QMutex>
 #include "httpglobal.h"
 #include "httpsession.h"
+#include "httpsessionbackend.h"
 #include "httpresponse.h"
 #include "httprequest.h"
 
@@ -29,7 +32,30 @@ namespace stefanfrings {
    cookiePath=/
    cookieComment=Session ID
    ;cookieDomain=stefanfrings.de
+   sessionShards=16
+   cleanupInterval=1000
+   journalFile=sessions.journal
    </pre></code>
+   <p>
+   The sessions are distributed over sessionShards hash tables, selected by a hash of the
+   session ID. Each shard has its own lock, so concurrent requests with different sessions
+   rarely wait for each other. Sessions are stored by their fixed size HttpSessionId, session
+   cookies with IDs of another format are ignored without a lookup.
+   <p>
+   Expired sessions are found with a timing wheel: each shard has a ring of buckets, one per
+   cleanupInterval milliseconds, and every session is listed in the bucket of the interval in
+   which it will expire. Each tick of the cleanup timer only looks at the buckets that became due,
+   so its cost depends on the number of expiring sessions instead of the total number.
+   Sessions expire at most cleanupInterval milliseconds late. The ring has at most 4096 buckets,
+   if the expirationTime is longer, a session passes its bucket once per round until it is due.
+   <p>
+   Sessions survive a restart if they are stored by a HttpSessionBackend. If journalFile is set,
+   a HttpSessionJournal with this file is used, relative paths are based on the directory of the
+   config file. New, modified and renewed sessions are collected and passed to the backend
+   once per cleanupInterval by the thread of the store. To keep the journal small, a renewed
+   session is only passed when its last access time moved by 1/16 of the expirationTime since it
+   was passed the last time, and on shutdown. So after a crash, a session may expire up to
+   1/16 of the expirationTime early.
  */
 
 class DECLSPEC HttpSessionStore : public QObject {
@@ -46,8 +72,10 @@ public:
        The HttpSessionStore does not take over ownership of the QSettings instance, so the
        caller should destroy it during shutdown.
        @param parent Parent object
+       @param backend Persistent storage for the sessions, overrides the journalFile setting.
+       The HttpSessionStore takes over ownership of the backend.
      */
-    explicit HttpSessionStore( const QSettings* settings, QObject* parent = nullptr );
+    explicit HttpSessionStore( const QSettings* settings, QObject* parent = nullptr, HttpSessionBackend* backend = nullptr );
 
     /** Destructor */
     virtual ~HttpSessionStore();
@@ -94,13 +122,83 @@ signals:
      */
     void sessionDeleted( const QByteArray& sessionId );
 
-protected:
-    /** Storage for the sessions */
-    QMap<QByteArray, HttpSession> sessions;
-
 private:
-    /** Configuration settings */
-    const QSettings* m_settings;
+
+    /** A stored session */
+    struct Entry {
+
+        /** Constructor, creates an entry with a null session */
+        Entry() : slot( 0 ) {}
+
+        /** Constructor, copies the session without changing its last access time */
+        explicit Entry( const HttpSession& session ) : session( session ), slot( 0 ) {}
+
+        /** The session */
+        HttpSession session;
+
+        /** Slot of the timing wheel in which the session is scheduled to expire */
+        qint64 slot;
+
+    };
+
+    /** A part of the session storage with its own lock */
+    struct Shard {
+
+        /** Storage for the sessions */
+        QHash<HttpSessionId, Entry> sessions;
+
+        /**
+           Ring of buckets with the IDs of the sessions that expire in a slot.
+           Buckets may contain IDs of removed or rescheduled sessions, they are skipped.
+         */
+        QVector<QVector<HttpSessionId>> wheel;
+
+        /** IDs of the sessions that need to be passed to the backend */
+        QSet<HttpSessionId> changed;
+
+        /** Used to synchronize threads */
+        QMutex mutex;
+
+    };
+
+    /** Get the shard that stores the session with the given ID */
+    Shard& shard( const HttpSessionId& key ) const;
+
+    /** Get the session ID from the cookies, without checking whether the session exists */
+    QByteArray cookieSessionId( const HttpRequest& request, HttpResponse& response ) const;
+
+    /**
+       Renew the last access time of a session and move it into the bucket of its new expiry slot.
+       The caller must hold the lock of the shard.
+     */
+    void touch( Shard& shard, const HttpSessionId& key, Entry& entry );
+
+    /**
+       Put a session into the bucket of the slot in which it expires, if it is not already there.
+       The caller must hold the lock of the shard.
+     */
+    void schedule( Shard& shard, const HttpSessionId& key, Entry& entry );
+
+    /** Insert the sessions of the backend */
+    void loadSessions();
+
+    /**
+       Pass the expired and the changed sessions of a shard to the backend.
+       The caller must not hold the lock of the shard.
+       @param shard The shard
+       @param expired IDs of the sessions that expired
+       @param exact Whether the last access times are passed even if they changed only a little
+     */
+    void saveSessions( Shard& shard, const QList<QByteArray>& expired, const bool exact = false );
+
+    /** Set the session cookie in the response */
+    void setSessionCookie( const HttpSession& session, HttpResponse& response ) const;
+
+    /** The shards of the session storage */
+    Shard* m_shards;
+
+    /** Number of shards */
+    int m_shardCount;
 
     /** Timer to remove expired sessions */
     QTimer m_cleanupTimer;
@@ -108,14 +206,32 @@ private:
     /** Name of the session cookie */
     QByteArray m_cookieName;
 
+    /** Path of the session cookie */
+    QByteArray m_cookiePath;
+
+    /** Comment of the session cookie */
+    QByteArray m_cookieComment;
+
+    /** Domain of the session cookie */
+    QByteArray m_cookieDomain;
+
     /** Time when sessions expire (in ms)*/
     int m_expirationTime;
 
-    /** Used to synchronize threads */
-    QMutex m_mutex;
+    /** Duration of a slot of the timing wheel (in ms) */
+    int m_cleanupInterval;
+
+    /** Number of buckets per shard */
+    int m_wheelSize;
+
+    /** The last slot that has been processed by the cleanup timer */
+    qint64 m_lastSlot;
+
+    /** Persistent storage for the sessions, may be null */
+    HttpSessionBackend* m_backend;
 
 private slots:
-    /** Called every minute to cleanup expired sessions. */
+    /** Called every cleanupInterval to remove the sessions of the slots that became due. */
     void sessionTimerEvent();
 
 };
@@ -7,6 +7,44 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QDateTime>
+#include <QCryptographicHash>
+#include <QLocale>
+#include <QStringList>
+#include <QMetaObject>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace stefanfrings {
+
+/**
+   Loads one file into the cache of a StaticFileController, executed by the pool of StaticFileController::warmUp().
+ */
+class StaticFileWarmUpTask : public QRunnable {
+public:
+    StaticFileWarmUpTask( StaticFileController* controller, const QFileInfo& info, const qint64 now,
+                          QAtomicInt* done, const int total ) :
+        m_controller( controller ),
+        m_info( info ),
+        m_now( now ),
+        m_done( done ),
+        m_total( total ) {}
+
+    void run() override {
+        m_controller->warmUpFile( m_info, m_now );
+        emit m_controller->warmUpProgress( m_done->fetchAndAddOrdered( 1 ) + 1, m_total );
+    }
+
+private:
+    StaticFileController* m_controller;
+    QFileInfo m_info;
+    qint64 m_now;
+    QAtomicInt* m_done;
+    int m_total;
+};
+
+} // end of namespace
 
 using namespace stefanfrings;
 
@@ -16,7 +54,10 @@ StaticFileController::StaticFileController( const QSettings* settings, QObject*
     m_docroot( settings->value( "path", "." ).toString() ),
     m_maxAge( settings->value( "maxAge", "60000" ).toInt() ),
     m_cacheTimeout( settings->value( "cacheTime", "60000" ).toInt() ),
-    m_maxCachedFileSize( settings->value( "maxCachedFileSize", "65536" ).toInt() ) {
+    m_maxCachedFileSize( settings->value( "maxCachedFileSize", "65536" ).toInt() ),
+    m_compressMinSize( settings->value( "compressMinSize", "0" ).toInt() ),
+    m_compressLevel( settings->value( "compressLevel", "9" ).toInt() ),
+    m_cacheResponses( settings->value( "cacheResponses", false ).toBool() ) {
 
     if ( !( m_docroot.startsWith( ":/" ) || m_docroot.startsWith( "qrc://" ) ) ) {
         // Convert relative path to absolute, based on the directory of the config file.
@@ -31,6 +72,17 @@ StaticFileController::StaticFileController( const QSettings* settings, QObject*
         }
     }
     m_cache.setMaxCost( settings->value( "cacheSize", "1000000" ).toInt() );
+    m_localCacheSize = settings->value( "localCacheSize", m_cache.maxCost() / 16 ).toLongLong();
+    initContentTypes( settings );
+    m_watcher = nullptr;
+    m_sweepLimit = 64;
+    if ( settings->value( "cacheWatch", false ).toBool() ) {
+        // Entries live until their file changes
+        m_cacheTimeout = 0;
+        m_watcher = new QFileSystemWatcher( this );
+        connect( m_watcher, &QFileSystemWatcher::fileChanged, this, &StaticFileController::fileChanged );
+        connect( m_watcher, &QFileSystemWatcher::directoryChanged, this, &StaticFileController::directoryChanged );
+    }
 
 #ifdef SUPERVERBOSE
     qDebug( "StaticFileController: docroot=%s, encoding=%s, maxAge=%i", qPrintable( m_docroot ), qPrintable( m_encoding ), m_maxAge );
@@ -41,25 +93,37 @@ StaticFileController::StaticFileController( const QSettings* settings, QObject*
 
 void StaticFileController::service( HttpRequest& request, HttpResponse& response ) {
     QByteArray path = request.getPath();
+    // Only the cached gzip variant is sent compressed, because the entity tags identify the exact bytes
+    response.setCompression( HttpCompressor::IDENTITY );
+    // Ranges refer to the uncompressed file
+    bool acceptsGzip = request.getHeader( "Range" ).isEmpty()
+                       && HttpCompressor::accepts( request.getHeader( "Accept-Encoding" ), HttpCompressor::GZIP );
     // Check if we have the file in cache
     qint64 now = QDateTime::currentMSecsSinceEpoch();
-    m_mutex.lock();
-    CacheEntry* entry = m_cache.object( path );
-    if ( entry && ( m_cacheTimeout == 0 || entry->created>now - m_cacheTimeout ) ) {
-        QByteArray document = entry->document; //copy the cached document, because other threads may destroy the cached entry immediately after mutex unlock.
-        QByteArray filename = entry->filename;
-        m_mutex.unlock();
+    CacheEntryPtr cached = cachedEntry( path, now );
+    if ( cached ) {
+        // The entry is immutable and stays alive as long as we hold the reference
 #ifdef SUPERVERBOSE
         qDebug( "StaticFileController: Cache hit for %s", path.data() );
 #endif
-        setContentType( filename, response );
+        if ( m_cacheResponses && canWriteSerialized( request, response ) ) {
+            if ( acceptsGzip && !cached->compressed.isEmpty() ) {
+                response.writeSerialized( cached->compressedResponse, cached->compressedHeaderSize );
+            } else {
+                response.writeSerialized( cached->response, cached->responseHeaderSize );
+            }
+            return;
+        }
+        if ( !cached->contentType.isEmpty() ) {
+            response.setHeader( "Content-Type", cached->contentType );
+        }
         response.setHeader( "Cache-Control", "max-age=" + QByteArray::number( m_maxAge / 1000 ) );
-        response.write( document, true );
+        response.setHeader( "Accept-Ranges", "bytes" );
+        writeEntry( *cached, request, acceptsGzip, response );
 
         return;
     }
 
-    m_mutex.unlock();
     // The file is not in cache.
 #ifdef SUPERVERBOSE
     qDebug( "StaticFileController: Cache miss for %s", path.data() );
@@ -75,81 +139,615 @@ void StaticFileController::service( HttpRequest& request, HttpResponse& response
     if ( QFileInfo( m_docroot + path ).isDir() ) {
         path += "/index.html";
     }
-    // Try to open the file
-    QFile file( m_docroot + path );
-#ifdef SUPERVERBOSE
-    qDebug( "StaticFileController: Open file %s", qPrintable( file.fileName() ) );
-#endif
-    if ( file.open( QIODevice::ReadOnly ) ) {
+    QFileInfo info( m_docroot + path );
+    if ( info.isFile() && info.size() > m_maxCachedFileSize ) {
+        // Large files are not cached. Check the validators before the file gets opened,
+        // the response reads the file while the client receives it.
         setContentType( path, response );
         response.setHeader( "Cache-Control", "max-age=" + QByteArray::number( m_maxAge / 1000 ) );
-        response.setHeader( "Content-Length", QByteArray::number( file.size() ) );
-        if ( file.size() <= m_maxCachedFileSize ) {
-            // Return the file content and store it also in the cache
-            entry = new CacheEntry();
-            while ( !file.atEnd() && !file.error() ) {
-                QByteArray buffer = file.read( 65536 );
-                response.write( buffer, false );
-                entry->document.append( buffer, false );
+        response.setHeader( "Accept-Ranges", "bytes" );
+        bool precompressed = hasPrecompressed( info );
+        bool gzip = precompressed && acceptsGzip;
+        if ( precompressed ) {
+            response.setHeader( "Vary", "Accept-Encoding" );
+        }
+        QFileInfo variant = gzip ? QFileInfo( info.filePath() + ".gz" ) : info;
+        QByteArray etag = entityTag( variant.size(), info.lastModified(), QByteArray(), gzip );
+        QByteArray lastModified = httpDate( info.lastModified() );
+        if ( setValidators( request, etag, info.lastModified(), lastModified, response ) ) {
+            return;
+        }
+        QList<HttpRange> ranges;
+        HttpRange::Result result = requestedRanges( request, etag, lastModified, variant.size(), ranges );
+        if ( result == HttpRange::UNSATISFIABLE ) {
+            writeNotSatisfiable( variant.size(), response );
+            return;
+        }
+        QFile* file = new QFile( variant.filePath() );
+        if ( file->open( QIODevice::ReadOnly ) ) {
+            if ( gzip ) {
+                response.setHeader( "Content-Encoding", "gzip" );
             }
-            entry->created = now;
-            entry->filename = path;
-            m_mutex.lock();
-            m_cache.insert( request.getPath(), entry, entry->document.size() );
-            m_mutex.unlock();
-
-        } else {
-            // Return the file content, do not store in cache
-            while ( !file.atEnd() && !file.error() ) {
-                response.write( file.read( 65536 ) );
+            if ( result == HttpRange::SATISFIABLE ) {
+                response.writeFileRanges( file, ranges );
+            } else {
+                response.writeFile( file, 0, file->size(), true );
             }
+            return;
         }
-        file.close();
+        qWarning( "StaticFileController: Cannot open existing file %s for reading", qPrintable( file->fileName() ) );
+        delete file;
+        response.setStatus( 403, "forbidden" );
+        response.write( "403 forbidden", true );
+        return;
+    }
+
+    // Try to open the file
+    QFile* file = new QFile( m_docroot + path );
+#ifdef SUPERVERBOSE
+    qDebug( "StaticFileController: Open file %s", qPrintable( file->fileName() ) );
+#endif
+    if ( file->open( QIODevice::ReadOnly ) ) {
+        setContentType( path, response );
+        response.setHeader( "Cache-Control", "max-age=" + QByteArray::number( m_maxAge / 1000 ) );
+        response.setHeader( "Accept-Ranges", "bytes" );
+        // Return the file content and store it also in the cache
+        CacheEntryPtr cached( createEntry( *file, info, path, now ) );
+        delete file;
+        insertEntry( request.getPath(), cached );
+        watchEntry( info, request.getPath(), cached );
+        writeEntry( *cached, request, acceptsGzip, response );
 
         return;
     }
 
-    if ( file.exists() ) {
-        qWarning( "StaticFileController: Cannot open existing file %s for reading", qPrintable( file.fileName() ) );
+    if ( file->exists() ) {
+        qWarning( "StaticFileController: Cannot open existing file %s for reading", qPrintable( file->fileName() ) );
+        delete file;
         response.setStatus( 403, "forbidden" );
         response.write( "403 forbidden", true );
 
         return;
     }
 
+    delete file;
     response.setStatus( 404, "not found" );
     response.write( "404 not found", true );
 }
 
-void StaticFileController::setContentType( const QString& fileName, HttpResponse& response ) const {
+StaticFileController::CacheEntryPtr StaticFileController::cachedEntry( const QByteArray& path, const qint64 now ) {
+    // Look into the table of this thread first, without any lock
+    LocalCache* local = localCache();
+    int generation = m_generation.loadAcquire();
+    if ( local->generation != generation ) {
+        // Some files changed since the table was filled
+        local->entries.clear();
+        local->cost = 0;
+        local->generation = generation;
+    }
+    CacheEntryPtr entry = local->entries.value( path );
+    if ( entry ) {
+        if ( m_cacheTimeout == 0 || entry->created>now - m_cacheTimeout ) {
+            local->hits.append( path );
+            if ( local->hits.size() >= 64 ) {
+                reportHits( local );
+            }
+            return entry;
+        }
+        // Expired, maybe another thread has already loaded the file again
+        local->cost -= entry->cost();
+        local->entries.remove( path );
+    }
 
-    // Todo: add all of your content types
-    const QMap<QString, QString> contentTypeMap = {
-        { ".png", "image/png" },
-        { ".jpg", "image/jpeg" },
-        { ".gif", "image/gif" },
-        { ".pdf", "application/pdf" },
-        { ".txt", "text/plain; charset=" + m_encoding },
-        { ".html", "text/html; charset=" + m_encoding },
-        { ".htm", "text/html; charset=" + m_encoding },
-        { ".css", "text/css" },
-        { ".js", "text/javascript" },
-        { ".svg", "image/svg+xml" },
-        { ".woff", "font/woff" },
-        { ".woff2", "font/woff2" },
-        { ".ttf", "application/x-font-ttf" },
-        { ".eot", "application/vnd.ms-fontobject" },
-        { ".otf", "application/font-otf" },
-        { ".json", "application/json" },
-        { ".xml", "text/xml" },
+    m_mutex.lock();
+    CacheEntryPtr* shared = m_cache.object( path );
+    if ( shared ) {
+        entry = *shared;
+    }
+    m_mutex.unlock();
+    if ( !entry || ( m_cacheTimeout != 0 && entry->created <= now - m_cacheTimeout ) ) {
+        return CacheEntryPtr();
+    }
+    storeLocal( local, path, entry );
+    return entry;
+}
+
+void StaticFileController::insertEntry( const QByteArray& path, const CacheEntryPtr& entry ) {
+    m_mutex.lock();
+    m_cache.insert( path, new CacheEntryPtr( entry ), entry->cost() );
+    m_mutex.unlock();
+    storeLocal( localCache(), path, entry );
+}
+
+StaticFileController::LocalCache* StaticFileController::localCache() {
+    if ( !m_localCache.hasLocalData() ) {
+        LocalCache* local = new LocalCache();
+        local->cost = 0;
+        local->generation = m_generation.loadAcquire();
+        m_localCache.setLocalData( local );
+    }
+    return m_localCache.localData();
+}
+
+void StaticFileController::storeLocal( LocalCache* local, const QByteArray& path, const CacheEntryPtr& entry ) const {
+    // The table keeps files alive that the shared cache may have already dropped,
+    // so each thread is limited to a fraction of the shared cache.
+    CacheEntryPtr previous = local->entries.take( path );
+    if ( previous ) {
+        local->cost -= previous->cost();
+    }
+    qint64 cost = entry->cost();
+    if ( cost > m_localCacheSize ) {
+        return;
+    }
+    if ( local->cost + cost > m_localCacheSize ) {
+        local->entries.clear();
+        local->cost = 0;
+    }
+    local->entries.insert( path, entry );
+    local->cost += cost;
+}
+
+void StaticFileController::reportHits( LocalCache* local ) {
+    // Cache hits only move the entries to the front of the LRU list of the shared cache.
+    // That is not urgent, so skip it if another thread holds the lock at the moment.
+    if ( m_mutex.tryLock() ) {
+        for ( const QByteArray& path : qAsConst( local->hits ) ) {
+            m_cache.object( path );
+        }
+        m_mutex.unlock();
+    }
+    local->hits.clear();
+}
+
+bool StaticFileController::hasPrecompressed( const QFileInfo& original ) const {
+    QFileInfo info( original.filePath() + ".gz" );
+    return info.isFile() && info.lastModified() >= original.lastModified();
+}
+
+QByteArray StaticFileController::compressedCopy( const QFileInfo& original, const QByteArray& document,
+                                                  const QByteArray& contentType ) const {
+    if ( hasPrecompressed( original ) ) {
+        QFile precompressed( original.filePath() + ".gz" );
+        if ( precompressed.open( QIODevice::ReadOnly ) ) {
+            return precompressed.readAll();
+        }
+        qWarning( "StaticFileController: Cannot open existing file %s for reading", qPrintable( precompressed.fileName() ) );
+    }
+    if ( m_compressMinSize > 0 && document.size() >= m_compressMinSize && HttpCompressor::isCompressible( contentType ) ) {
+        QByteArray compressed = HttpCompressor::compress( document, HttpCompressor::GZIP, m_compressLevel );
+        if ( !compressed.isEmpty() && compressed.size() < document.size() ) {
+            return compressed;
+        }
+    }
+    return QByteArray();
+}
+
+void StaticFileController::writeEntry( const CacheEntry& entry, const HttpRequest& request, const bool acceptsGzip,
+                                       HttpResponse& response ) const {
+    bool gzip = acceptsGzip && !entry.compressed.isEmpty();
+    if ( !entry.compressed.isEmpty() ) {
+        response.setHeader( "Vary", "Accept-Encoding" );
+    }
+    const QByteArray& etag = gzip ? entry.compressedEtag : entry.etag;
+    if ( setValidators( request, etag, entry.modified, entry.lastModified, response ) ) {
+        return;
+    }
+    const QByteArray& content = gzip ? entry.compressed : entry.document;
+    if ( gzip ) {
+        response.setHeader( "Content-Encoding", "gzip" );
+    }
+    QList<HttpRange> ranges;
+    switch ( requestedRanges( request, etag, entry.lastModified, content.size(), ranges ) ) {
+    case HttpRange::SATISFIABLE:
+        response.writeRanges( content, ranges );
+        break;
+    case HttpRange::UNSATISFIABLE:
+        writeNotSatisfiable( content.size(), response );
+        break;
+    default:
+        response.write( content, true );
+    }
+}
+
+HttpRange::Result StaticFileController::requestedRanges( const HttpRequest& request, const QByteArray& etag,
+                                                         const QByteArray& lastModified, const qint64 size,
+                                                         QList<HttpRange>& ranges ) const {
+    QByteArray range = request.getHeader( "Range" );
+    if ( range.isEmpty() || request.getMethod() != "GET" ) {
+        return HttpRange::NONE;
+    }
+    // If-Range asks for the whole file, unless the client has the current variant.
+    // Weak entity tags never match here, because they are not suitable for ranges.
+    QByteArray ifRange = request.getHeader( "If-Range" ).trimmed();
+    if ( !ifRange.isEmpty() && ifRange != etag && ( lastModified.isEmpty() || ifRange != lastModified ) ) {
+        return HttpRange::NONE;
+    }
+    return HttpRange::parse( range, size, ranges );
+}
+
+void StaticFileController::writeNotSatisfiable( const qint64 size, HttpResponse& response ) const {
+    response.setStatus( 416, "Range Not Satisfiable" );
+    response.setHeader( "Content-Range", "bytes */" + QByteArray::number( size ) );
+    response.getHeaders().remove( "Content-Type" );
+    response.getHeaders().remove( "Content-Encoding" );
+    response.write( QByteArray(), true );
+}
+
+QByteArray StaticFileController::entityTag( const qint64 size, const QDateTime& modified, const QByteArray& hash,
+                                             const bool gzip ) {
+    // Each variant of a file needs its own strong entity tag
+    QByteArray etag = "\"" + QByteArray::number( size, 16 ) + "-"
+                      + QByteArray::number( modified.isValid() ? modified.toMSecsSinceEpoch() : 0, 16 );
+    if ( !hash.isEmpty() ) {
+        etag += "-" + hash;
+    }
+    if ( gzip ) {
+        etag += "-gz";
+    }
+    return etag + "\"";
+}
+
+QByteArray StaticFileController::httpDate( const QDateTime& time ) {
+    if ( !time.isValid() ) {
+        return QByteArray();
+    }
+    return QLocale::c().toString( time.toUTC(), "ddd, dd MMM yyyy hh:mm:ss 'GMT'" ).toLatin1();
+}
+
+bool StaticFileController::setValidators( const HttpRequest& request, const QByteArray& etag, const QDateTime& modified,
+                                          const QByteArray& lastModified, HttpResponse& response ) const {
+    response.setHeader( "ETag", etag );
+    if ( !lastModified.isEmpty() ) {
+        response.setHeader( "Last-Modified", lastModified );
+    }
+    if ( request.getMethod() != "GET" && request.getMethod() != "HEAD" ) {
+        return false;
+    }
+    bool notModified = false;
+    QByteArray ifNoneMatch = request.getHeader( "If-None-Match" );
+    if ( !ifNoneMatch.isEmpty() ) {
+        // If-None-Match takes precedence over If-Modified-Since, it uses the weak comparison
+        const QList<QByteArray> tags = ifNoneMatch.split( ',' );
+        for ( const QByteArray& item : tags ) {
+            QByteArray tag = item.trimmed();
+            if ( tag.startsWith( "W/" ) ) {
+                tag = tag.mid( 2 );
+            }
+            if ( tag == "*" || tag == etag ) {
+                notModified = true;
+                break;
+            }
+        }
+    } else if ( modified.isValid() ) {
+        QByteArray ifModifiedSince = request.getHeader( "If-Modified-Since" );
+        if ( !ifModifiedSince.isEmpty() ) {
+            QDateTime since = QLocale::c().toDateTime( QString::fromLatin1( ifModifiedSince.trimmed() ),
+                                                        "ddd, dd MMM yyyy hh:mm:ss 'GMT'" );
+            since.setTimeSpec( Qt::UTC );
+            // HTTP dates have a resolution of one second
+            notModified = since.isValid() && modified.toMSecsSinceEpoch() / 1000 <= since.toMSecsSinceEpoch() / 1000;
+        }
+    }
+    if ( notModified ) {
+#ifdef SUPERVERBOSE
+        qDebug( "StaticFileController: not modified, etag %s", etag.data() );
+#endif
+        response.setStatus( 304, "Not Modified" );
+        response.write( QByteArray(), true );
+    }
+    return notModified;
+}
+
+StaticFileController::CacheEntry* StaticFileController::createEntry( QFile& file, const QFileInfo& info, const QByteArray& path,
+                                                                    const qint64 now ) const {
+    CacheEntry* entry = new CacheEntry();
+    entry->document = file.readAll();
+    entry->contentType = contentType( path );
+    entry->compressed = compressedCopy( info, entry->document, entry->contentType );
+    entry->modified = info.lastModified();
+    entry->lastModified = httpDate( entry->modified );
+    QByteArray hash = QCryptographicHash::hash( entry->document, QCryptographicHash::Md5 ).left( 8 ).toHex();
+    entry->etag = entityTag( entry->document.size(), entry->modified, hash, false );
+    if ( !entry->compressed.isEmpty() ) {
+        entry->compressedEtag = entityTag( entry->compressed.size(), entry->modified, hash, true );
+    }
+    entry->created = now;
+    entry->filename = path;
+    entry->responseHeaderSize = 0;
+    entry->compressedHeaderSize = 0;
+    if ( m_cacheResponses ) {
+        entry->response = serialize( *entry, false, entry->responseHeaderSize );
+        if ( !entry->compressed.isEmpty() ) {
+            entry->compressedResponse = serialize( *entry, true, entry->compressedHeaderSize );
+        }
+    }
+    return entry;
+}
+
+QByteArray StaticFileController::serialize( const CacheEntry& entry, const bool gzip, int& headerSize ) const {
+    const QByteArray& body = gzip ? entry.compressed : entry.document;
+    QByteArray buffer;
+    buffer.reserve( 400 + body.size() );
+    buffer.append( "HTTP/1.1 200 OK\r\n" );
+    if ( !entry.contentType.isEmpty() ) {
+        buffer.append( "Content-Type: " + entry.contentType + "\r\n" );
+    }
+    if ( gzip ) {
+        buffer.append( "Content-Encoding: gzip\r\n" );
+    }
+    buffer.append( "Content-Length: " + QByteArray::number( body.size() ) + "\r\n" );
+    buffer.append( "Cache-Control: max-age=" + QByteArray::number( m_maxAge / 1000 ) + "\r\n" );
+    buffer.append( "Accept-Ranges: bytes\r\n" );
+    buffer.append( "ETag: " + ( gzip ? entry.compressedEtag : entry.etag ) + "\r\n" );
+    if ( !entry.lastModified.isEmpty() ) {
+        buffer.append( "Last-Modified: " + entry.lastModified + "\r\n" );
+    }
+    if ( !entry.compressed.isEmpty() ) {
+        buffer.append( "Vary: Accept-Encoding\r\n" );
+    }
+    buffer.append( "\r\n" );
+    headerSize = buffer.size();
+    buffer.append( body );
+    return buffer;
+}
+
+bool StaticFileController::canWriteSerialized( const HttpRequest& request, HttpResponse& response ) const {
+    // Conditional and range requests need the regular path
+    if ( request.getMethod() != "GET" || !request.getHeader( "Range" ).isEmpty()
+         || !request.getHeader( "If-None-Match" ).isEmpty() || !request.getHeader( "If-Modified-Since" ).isEmpty() ) {
+        return false;
+    }
+    if ( response.getStatusCode() != 200 ) {
+        return false;
+    }
+    // Headers set by the caller are added, but must not collide with the serialized ones
+    static const char* const serializedHeaders[] = {
+        "Content-Type", "Content-Encoding", "Content-Length", "Transfer-Encoding", "Cache-Control",
+        "Accept-Ranges", "ETag", "Last-Modified", "Vary"
     };
+    const QMap<QByteArray, QByteArray>& headers = response.getHeaders();
+    for ( auto header = headers.cbegin(); header != headers.cend(); ++header ) {
+        for ( const char* name : serializedHeaders ) {
+            if ( qstricmp( header.key().constData(), name ) == 0 ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
-    for ( auto contentType = contentTypeMap.cbegin(); contentType != contentTypeMap.cend(); ++contentType ) {
-        if ( fileName.endsWith( contentType.key() ) ) {
-            response.setHeader( "Content-Type", qPrintable( contentType.value() ) );
-            return;
+void StaticFileController::watchEntry( const QFileInfo& info, const QByteArray& path, const CacheEntryPtr& entry ) {
+    if ( m_watcher && !info.filePath().startsWith( ":" ) ) {
+        // QFileSystemWatcher is not thread-safe, so let the thread of the controller add the watch
+        QMetaObject::invokeMethod( this, "watchFile", Qt::QueuedConnection, Q_ARG( QString, info.absoluteFilePath() ),
+                                   Q_ARG( QByteArray, path ), Q_ARG( QDateTime, entry->modified ) );
+    }
+}
+
+void StaticFileController::warmUp() {
+    QElapsedTimer timer;
+    timer.start();
+    // Collect the files that fit into the cache
+    QList<QFileInfo> files;
+    qint64 cost = 0;
+    QDirIterator iterator( m_docroot, QDir::Files | QDir::Readable, QDirIterator::Subdirectories );
+    while ( iterator.hasNext() ) {
+        iterator.next();
+        QFileInfo info = iterator.fileInfo();
+        if ( info.size() > m_maxCachedFileSize ) {
+            continue;
+        }
+        if ( info.suffix() == "gz" && QFileInfo( info.path() + "/" + info.completeBaseName() ).isFile() ) {
+            // Precompressed variant, loaded together with the original file
+            continue;
+        }
+        if ( cost + info.size() > m_cache.maxCost() ) {
+            qWarning( "StaticFileController: cacheSize is too small to warm up all files" );
+            break;
+        }
+        cost += info.size();
+        files.append( info );
+    }
+
+    // Load the files in parallel
+    QThreadPool pool;
+    QAtomicInt done;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for ( const QFileInfo& info : qAsConst( files ) ) {
+        pool.start( new StaticFileWarmUpTask( this, info, now, &done, files.size() ) );
+    }
+    pool.waitForDone();
+    qDebug( "StaticFileController: warmed up %i files with %lli bytes in %lli ms",
+            files.size(), cost, static_cast<long long>( timer.elapsed() ) );
+}
+
+void StaticFileController::warmUpFile( const QFileInfo& info, const qint64 now ) {
+    QFile file( info.filePath() );
+    if ( !file.open( QIODevice::ReadOnly ) ) {
+        qWarning( "StaticFileController: Cannot open existing file %s for reading", qPrintable( file.fileName() ) );
+        return;
+    }
+    QByteArray path = info.filePath().mid( m_docroot.size() ).toUtf8();
+    CacheEntryPtr entry( createEntry( file, info, path, now ) );
+    // Requests for a directory get the index.html file
+    QList<QByteArray> keys;
+    keys.append( path );
+    if ( path.endsWith( "/index.html" ) ) {
+        QByteArray directory = path.left( path.size() - 10 );
+        keys.append( directory );
+        if ( directory.size() > 1 ) {
+            keys.append( directory.left( directory.size() - 1 ) );
+        }
+    }
+    // Store only in the shared cache, the tables of the pool threads would never be used
+    m_mutex.lock();
+    for ( const QByteArray& key : qAsConst( keys ) ) {
+        m_cache.insert( key, new CacheEntryPtr( entry ), entry->cost() );
+    }
+    m_mutex.unlock();
+    for ( const QByteArray& key : qAsConst( keys ) ) {
+        watchEntry( info, key, entry );
+    }
+}
+
+void StaticFileController::initContentTypes( const QSettings* settings ) {
+    // Todo: add all of your content types
+    const QByteArray charset = "; charset=" + m_encoding.toLatin1();
+    m_contentTypes.insert( "png", "image/png" );
+    m_contentTypes.insert( "jpg", "image/jpeg" );
+    m_contentTypes.insert( "jpeg", "image/jpeg" );
+    m_contentTypes.insert( "gif", "image/gif" );
+    m_contentTypes.insert( "webp", "image/webp" );
+    m_contentTypes.insert( "ico", "image/x-icon" );
+    m_contentTypes.insert( "pdf", "application/pdf" );
+    m_contentTypes.insert( "txt", "text/plain" + charset );
+    m_contentTypes.insert( "html", "text/html" + charset );
+    m_contentTypes.insert( "htm", "text/html" + charset );
+    m_contentTypes.insert( "css", "text/css" );
+    m_contentTypes.insert( "js", "text/javascript" );
+    m_contentTypes.insert( "mjs", "text/javascript" );
+    m_contentTypes.insert( "svg", "image/svg+xml" );
+    m_contentTypes.insert( "woff", "font/woff" );
+    m_contentTypes.insert( "woff2", "font/woff2" );
+    m_contentTypes.insert( "ttf", "application/x-font-ttf" );
+    m_contentTypes.insert( "eot", "application/vnd.ms-fontobject" );
+    m_contentTypes.insert( "otf", "application/font-otf" );
+    m_contentTypes.insert( "json", "application/json" );
+    m_contentTypes.insert( "xml", "text/xml" );
+    m_contentTypes.insert( "wasm", "application/wasm" );
+    m_contentTypes.insert( "mp4", "video/mp4" );
+
+    // Additional types from the settings, e.g. "mimeTypes=webm=video/webm,mp3=audio/mpeg"
+    const QStringList list = settings->value( "mimeTypes" ).toStringList();
+    for ( const QString& item : list ) {
+        int equals = item.indexOf( '=' );
+        if ( equals <= 0 ) {
+            qWarning( "StaticFileController: invalid mimeTypes entry '%s'", qPrintable( item ) );
+            continue;
+        }
+        QString suffix = item.left( equals ).trimmed().toLower();
+        if ( suffix.startsWith( '.' ) ) {
+            suffix.remove( 0, 1 );
+        }
+        m_contentTypes.insert( suffix, item.mid( equals + 1 ).trimmed().toLatin1() );
+    }
+}
+
+QByteArray StaticFileController::contentType( const QString& fileName ) const {
+    int dot = fileName.lastIndexOf( '.' );
+    if ( dot < 0 || dot < fileName.lastIndexOf( '/' ) ) {
+        return QByteArray();
+    }
+    return m_contentTypes.value( fileName.mid( dot + 1 ).toLower() );
+}
+
+void StaticFileController::setContentType( const QString& fileName, HttpResponse& response ) const {
+    QByteArray type = contentType( fileName );
+    if ( type.isEmpty() ) {
+        qWarning( "StaticFileController: unknown MIME type for filename '%s'", qPrintable( fileName ) );
+        return;
+    }
+    response.setHeader( "Content-Type", type );
+}
+
+void StaticFileController::watchFile( const QString& fileName, const QByteArray& path, const QDateTime& modified ) {
+    WatchedFile& watched = m_watched[fileName];
+    if ( watched.paths.isEmpty() ) {
+        m_watcher->addPath( fileName );
+        watched.modified = modified;
+        watched.compressedModified = QFileInfo( fileName + ".gz" ).lastModified();
+        // New files and precompressed variants appear in the directory
+        QSet<QString>& files = m_watchedDirectories[QFileInfo( fileName ).absolutePath()];
+        if ( files.isEmpty() ) {
+            m_watcher->addPath( QFileInfo( fileName ).absolutePath() );
+        }
+        files.insert( fileName );
+    }
+    if ( !watched.paths.contains( path ) ) {
+        watched.paths.append( path );
+    }
+    // The file might have changed before the watch started
+    if ( watched.modified != modified || QFileInfo( fileName ).lastModified() != modified ) {
+        invalidate( QStringList( fileName ) );
+        return;
+    }
+    // Entries leave the shared cache silently, so look for unused watches when their number doubled
+    if ( m_watched.size() > m_sweepLimit ) {
+        sweepWatches();
+    }
+}
+
+void StaticFileController::fileChanged( const QString& fileName ) {
+    invalidate( QStringList( fileName ) );
+}
+
+void StaticFileController::directoryChanged( const QString& directory ) {
+    // Only files that have been replaced or removed, or whose precompressed variant changed
+    QStringList changed;
+    const QSet<QString> fileNames = m_watchedDirectories.value( directory );
+    for ( const QString& fileName : fileNames ) {
+        const WatchedFile& watched = m_watched[fileName];
+        if ( QFileInfo( fileName ).lastModified() != watched.modified
+             || QFileInfo( fileName + ".gz" ).lastModified() != watched.compressedModified ) {
+            changed.append( fileName );
+        }
+    }
+    invalidate( changed );
+}
+
+void StaticFileController::invalidate( const QStringList& fileNames ) {
+    QList<QByteArray> paths;
+    for ( const QString& fileName : fileNames ) {
+        if ( !m_watched.contains( fileName ) ) {
+            continue;
         }
+#ifdef SUPERVERBOSE
+        qDebug( "StaticFileController: %s changed", qPrintable( fileName ) );
+#endif
+        paths.append( m_watched.value( fileName ).paths );
+        unwatch( fileName );
+    }
+    if ( paths.isEmpty() ) {
+        return;
+    }
+    m_mutex.lock();
+    for ( const QByteArray& path : qAsConst( paths ) ) {
+        m_cache.remove( path );
     }
+    m_mutex.unlock();
+    m_generation.ref();
+}
+
+void StaticFileController::unwatch( const QString& fileName ) {
+    m_watched.remove( fileName );
+    m_watcher->removePath( fileName );
+    QString directory = QFileInfo( fileName ).absolutePath();
+    QSet<QString>& files = m_watchedDirectories[directory];
+    files.remove( fileName );
+    if ( files.isEmpty() ) {
+        m_watchedDirectories.remove( directory );
+        m_watcher->removePath( directory );
+    }
+}
 
-    qWarning( "StaticFileController: unknown MIME type for filename '%s'", qPrintable( fileName ) );
+void StaticFileController::sweepWatches() {
+    QStringList unused;
+    m_mutex.lock();
+    for ( auto watched = m_watched.begin(); watched != m_watched.end(); ++watched ) {
+        QList<QByteArray>& paths = watched->paths;
+        for ( int i = paths.size() - 1; i >= 0; --i ) {
+            if ( !m_cache.contains( paths.at( i ) ) ) {
+                paths.removeAt( i );
+            }
+        }
+        if ( paths.isEmpty() ) {
+            unused.append( watched.key() );
+        }
+    }
+    m_mutex.unlock();
+    for ( const QString& fileName : qAsConst( unused ) ) {
+        unwatch( fileName );
+    }
+    m_sweepLimit = qMax( 2 * m_watched.size(), 64 );
 }
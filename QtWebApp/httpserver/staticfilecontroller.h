@@ -6,8 +6,18 @@
 #ifndef STATICFILECONTROLLER_H
 #define STATICFILECONTROLLER_H
 
+#include <QAtomicInt>
 #include <QCache>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QList>
 #include <QMutex>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadStorage>
 #include "httpglobal.h"
 #include "httprequest.h"
 #include "httpresponse.h"
@@ -26,17 +36,69 @@ namespace stefanfrings {
    maxAge=60000
    cacheTime=60000
    cacheSize=1000000
+   ;localCacheSize=62500
+   ;cacheWatch=true
    maxCachedFileSize=65536
+   compressMinSize=1024
+   compressLevel=9
+   ;mimeTypes=webm=video/webm,mp3=audio/mpeg
+   ;cacheResponses=true
    </pre></code>
    The path is relative to the directory of the config file. In case of windows, if the
    settings are in the registry, the path is relative to the current working directory.
    <p>
    The encoding is sent to the web browser in case of text and html files.
    <p>
+   The content type is looked up by the file name suffix in a table, which is built once
+   by the constructor. The mimeTypes setting adds types to the table or replaces built-in
+   ones. Cached files remember their content type, so cache hits do not look it up again.
+   <p>
    The cache improves performance of small files when loaded from a network
    drive. Large files are not cached. Files are cached as long as possible,
    when cacheTime=0. The maxAge value (in msec!) controls the remote browsers cache.
    <p>
+   With cacheWatch=true, cached files do not expire by time. Instead, a QFileSystemWatcher
+   (inotify on Linux) observes the cached files and their directories, and exactly the changed
+   files are removed from the cache. Files that the cache dropped to make room for others are no
+   longer watched. This requires an event loop in the thread that created the controller. Files in Qt resources are never watched, because they cannot change.
+   <p>
+   Files larger than maxCachedFileSize are passed to HttpResponse::writeFile(). On Linux
+   they are sent with sendfile() without copying them through the process, unless the
+   connection is encrypted.
+   <p>
+   Web browsers that accept gzip receive a precompressed variant of the file, if a file with
+   the additional extension ".gz" exists next to it and is not older than the original file.
+   If compressMinSize is greater than 0 and the library has been built with zlib, cached
+   files of compressible types with at least compressMinSize bytes are compressed once when
+   they are loaded, and the compressed variant is kept in the cache together with the original.
+   The compressLevel ranges from 1 (fast) to 9 (small).
+   <p>
+   Responses carry ETag and Last-Modified headers. Web browsers revalidate their copy with
+   If-None-Match or If-Modified-Since, and receive a 304 response without body if the file has
+   not changed. The entity tag of a cached file consists of its size, modification time and a
+   hash of its content, computed once when the file is loaded. Large files are not hashed, their
+   entity tag consists of the size and modification time only, so a 304 response is sent
+   without opening them. Compressed variants have their own entity tag.
+   <p>
+   Range requests are answered with status 206, a single range as it is and multiple ranges
+   as multipart/byteranges, so interrupted downloads can be resumed. If-Range is supported.
+   Ranges always refer to the uncompressed file. Large files are passed range by range to
+   HttpResponse::writeFileRanges(), which also uses sendfile() if possible.
+   <p>
+   Cached files are immutable and reference counted. Each thread keeps its own table of
+   recently used entries, so a cache hit does not take any lock. Only misses look into the
+   shared cache, which is protected by a mutex. The least-recently-used order of the shared
+   cache is updated in batches, whenever the mutex happens to be free. The table of a thread
+   may keep entries alive that the shared cache already dropped, so each table is limited to
+   localCacheSize bytes, by default 1/16 of cacheSize. Then all threads together keep at most
+   about cacheSize bytes beyond the shared cache, if there are not more than 16 of them.
+   <p>
+   With cacheResponses=true, each cached file also keeps its complete response, including the
+   status line and headers, in one contiguous buffer. A cache hit of a plain GET request is
+   then passed to the socket as it is by HttpResponse::writeSerialized(), without building
+   any headers. Conditional and range requests still take the regular path. The buffers are
+   counted against cacheSize, so the cache holds about half as many files in this mode.
+   <p>
    Do not instantiate this class in each request, because this would make the file cache
    useless. Better create one instance during start-up and call it when the application
    received a related HTTP request.
@@ -45,6 +107,7 @@ namespace stefanfrings {
 class DECLSPEC StaticFileController : public HttpRequestHandler  {
     Q_OBJECT
     Q_DISABLE_COPY( StaticFileController )
+    friend class StaticFileWarmUpTask;
 
 public:
     /**
@@ -62,6 +125,13 @@ public:
     /** Generates the response */
     void service( HttpRequest& request, HttpResponse& response ) override;
 
+    /**
+       Load all files up to maxCachedFileSize below the docroot into the cache,
+       in parallel by a pool of threads. Emits warmUpProgress() for each loaded file.
+       Stops at cacheSize, because further files would only displace the previous ones.
+     */
+    void warmUp() override;
+
 private:
     /** Encoding of text files */
     QString m_encoding;
@@ -72,10 +142,51 @@ private:
     /** Maximum age of files in the browser cache */
     int m_maxAge;
 
+    /** Content types, key is the lower-case file name suffix without dot */
+    QHash<QString, QByteArray> m_contentTypes;
+
+    /** Cached file, never modified after it has been added to the cache */
     struct CacheEntry {
         QByteArray document;
+        /** Value of the Content-Type header, empty if unknown */
+        QByteArray contentType;
+        /** gzip variant of the document, empty if compression is not worth it */
+        QByteArray compressed;
+        /** Entity tag of the document */
+        QByteArray etag;
+        /** Entity tag of the gzip variant */
+        QByteArray compressedEtag;
+        /** Modification time of the file */
+        QDateTime modified;
+        /** Modification time formatted for the Last-Modified header */
+        QByteArray lastModified;
         qint64 created;
         QByteArray filename;
+        /** Complete response with the document, if cacheResponses is enabled */
+        QByteArray response;
+        /** Size of the status line and headers in response */
+        int responseHeaderSize;
+        /** Complete response with the gzip variant, if cacheResponses is enabled */
+        QByteArray compressedResponse;
+        /** Size of the status line and headers in compressedResponse */
+        int compressedHeaderSize;
+        /** Memory used by the entry */
+        int cost() const { return document.size() + compressed.size() + response.size() + compressedResponse.size(); }
+    };
+
+    /** Reference to a cached file, keeps the entry alive while it is in use */
+    typedef QSharedPointer<const CacheEntry> CacheEntryPtr;
+
+    /** Cache entries that have been used by one thread */
+    struct LocalCache {
+        /** Entries, key is the path */
+        QHash<QByteArray, CacheEntryPtr> entries;
+        /** Total size of the entries */
+        qint64 cost;
+        /** Value of m_generation when the entries were collected */
+        int generation;
+        /** Paths of cache hits, that have not been reported to the shared cache yet */
+        QList<QByteArray> hits;
     };
 
     /** Timeout for each cached file */
@@ -84,14 +195,179 @@ private:
     /** Maximum size of files in cache, larger files are not cached */
     int m_maxCachedFileSize;
 
-    /** Cache storage */
-    QCache<QString, CacheEntry> m_cache;
+    /** Minimum size of cached files to be compressed, 0 disables compression */
+    int m_compressMinSize;
+
+    /** Compression level 1-9 */
+    int m_compressLevel;
+
+    /** Whether cached files keep a complete, serialized response */
+    bool m_cacheResponses;
 
-    /** Used to synchronize cache access for threads */
+    /** Maximum size of the entries in the table of each thread */
+    qint64 m_localCacheSize;
+
+    /** Shared cache storage */
+    QCache<QByteArray, CacheEntryPtr> m_cache;
+
+    /** Used to synchronize access to the shared cache */
     QMutex m_mutex;
 
+    /** Per-thread tables of recently used cache entries */
+    QThreadStorage<LocalCache*> m_localCache;
+
+    /** Incremented whenever a cached file changed, invalidates the tables of all threads */
+    QAtomicInt m_generation;
+
+    /** Watches the cached files, NULL if cacheWatch is disabled */
+    QFileSystemWatcher* m_watcher;
+
+    /** A cached file that is watched for changes */
+    struct WatchedFile {
+        /** Paths of the requests, which are the cache keys */
+        QList<QByteArray> paths;
+        /** Modification time of the cached content */
+        QDateTime modified;
+        /** Modification time of the precompressed variant, invalid if there is none */
+        QDateTime compressedModified;
+    };
+
+    /** Watched files, key is the file name. Used only by the thread of the controller. */
+    QHash<QString, WatchedFile> m_watched;
+
+    /** Names of the watched files, key is the directory. Used only by the thread of the controller. */
+    QHash<QString, QSet<QString> > m_watchedDirectories;
+
+    /** Number of watched files that triggers the next sweep for files that left the cache */
+    int m_sweepLimit;
+
+    /**
+       Get a cached file.
+       @param path Path of the request
+       @param now Current time in msec since epoch, to check the cacheTime
+       @return the entry, or a NULL pointer if the file is not cached or expired
+     */
+    CacheEntryPtr cachedEntry( const QByteArray& path, const qint64 now );
+
+    /** Add a file to the cache */
+    void insertEntry( const QByteArray& path, const CacheEntryPtr& entry );
+
+    /** Get the table of the current thread */
+    LocalCache* localCache();
+
+    /** Add an entry to the table of the current thread */
+    void storeLocal( LocalCache* local, const QByteArray& path, const CacheEntryPtr& entry ) const;
+
+    /** Report the cache hits of the current thread to the shared cache, if its mutex is free */
+    void reportHits( LocalCache* local );
+
+    /** Whether a precompressed ".gz" variant of the file exists, that is not older than the file */
+    bool hasPrecompressed( const QFileInfo& original ) const;
+
+    /** Get the gzip variant of a document that is about to be cached, empty if compression is not worth it */
+    QByteArray compressedCopy( const QFileInfo& original, const QByteArray& document, const QByteArray& contentType ) const;
+
+    /** Write a cached file, prefer the compressed variant if the client accepts it */
+    void writeEntry( const CacheEntry& entry, const HttpRequest& request, const bool acceptsGzip, HttpResponse& response ) const;
+
+    /**
+       Get the ranges requested by the Range header, considering If-Range.
+       @param request The request
+       @param etag Entity tag of the variant
+       @param lastModified Modification time formatted by httpDate()
+       @param size Size of the variant
+       @param ranges Receives the satisfiable ranges
+     */
+    HttpRange::Result requestedRanges( const HttpRequest& request, const QByteArray& etag, const QByteArray& lastModified,
+                                       const qint64 size, QList<HttpRange>& ranges ) const;
+
+    /** Send a 416 response, because none of the requested ranges exists */
+    void writeNotSatisfiable( const qint64 size, HttpResponse& response ) const;
+
+    /**
+       Create a strong entity tag.
+       @param size Size of the variant that is sent
+       @param modified Modification time of the file
+       @param hash Hash of the content, may be empty for large files
+       @param gzip Whether the variant is compressed
+     */
+    static QByteArray entityTag( const qint64 size, const QDateTime& modified, const QByteArray& hash, const bool gzip );
+
+    /** Format a time for HTTP headers, empty if the time is invalid */
+    static QByteArray httpDate( const QDateTime& time );
+
+    /**
+       Set the ETag and Last-Modified headers, and send a 304 response if the
+       client already has the current variant according to If-None-Match or If-Modified-Since.
+       @param request The request
+       @param etag Entity tag of the variant
+       @param modified Modification time of the file
+       @param lastModified Modification time formatted by httpDate()
+       @param response The response
+       @return true if the 304 response has been sent
+     */
+    bool setValidators( const HttpRequest& request, const QByteArray& etag, const QDateTime& modified,
+                        const QByteArray& lastModified, HttpResponse& response ) const;
+
+    /**
+       Load a file into a new cache entry.
+       @param file The opened file
+       @param info Information about the file
+       @param path Name of the file relative to the docroot
+       @param now Current time in msec since epoch
+     */
+    CacheEntry* createEntry( QFile& file, const QFileInfo& info, const QByteArray& path, const qint64 now ) const;
+
+    /**
+       Serialize the complete response for a cached file, sub-procedure of createEntry().
+       @param entry The cached file
+       @param gzip Whether to serialize the compressed variant
+       @param headerSize Receives the size of the status line and headers
+     */
+    QByteArray serialize( const CacheEntry& entry, const bool gzip, int& headerSize ) const;
+
+    /** Whether a cache hit can be answered with the serialized response */
+    bool canWriteSerialized( const HttpRequest& request, HttpResponse& response ) const;
+
+    /** Let the watcher observe the file of a new cache entry, if cacheWatch is enabled */
+    void watchEntry( const QFileInfo& info, const QByteArray& path, const CacheEntryPtr& entry );
+
+    /** Load a file into the shared cache, called by the pool of warmUp() */
+    void warmUpFile( const QFileInfo& info, const qint64 now );
+
+    /** Fill m_contentTypes with the built-in types and the types of the mimeTypes setting */
+    void initContentTypes( const QSettings* settings );
+
+    /** Get the content type depending on the suffix of the filename, empty if unknown */
+    QByteArray contentType( const QString& fileName ) const;
+
     /** Set a content-type header in the response depending on the ending of the filename */
     void setContentType( const QString& file, HttpResponse& response ) const;
+
+    /** Remove the entries of some files from the shared cache and the tables of all threads */
+    void invalidate( const QStringList& fileNames );
+
+    /** Stop watching a file, and its directory if no other files in there are watched */
+    void unwatch( const QString& fileName );
+
+    /** Stop watching the files whose entries have been dropped by the shared cache to make room for others */
+    void sweepWatches();
+
+private slots:
+
+    /**
+       Start watching a file that has been added to the cache. Called in the thread of the controller.
+       @param fileName Absolute name of the file
+       @param path Path of the request, which is the cache key
+       @param modified Modification time of the cached content
+     */
+    void watchFile( const QString& fileName, const QByteArray& path, const QDateTime& modified );
+
+    /** Called by the watcher when a file has been modified or removed */
+    void fileChanged( const QString& fileName );
+
+    /** Called by the watcher when files have been added, removed or renamed in a directory */
+    void directoryChanged( const QString& directory );
 };
 
 } // end of namespace
@@ -2,6 +2,37 @@
 #include <QDateTime>
 #include <QStringList>
 #include <QSet>
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace stefanfrings {
+
+/**
+  Loads one template into the cache, executed by the pool of TemplateCache::warmUp().
+*/
+class TemplateWarmUpTask : public QRunnable {
+public:
+    TemplateWarmUpTask(TemplateCache* cache, const QString name, QAtomicInt* done, const int total)
+        : cache(cache), name(name), done(done), total(total) {}
+
+    void run() override
+    {
+        cache->tryFile(name);
+        emit cache->warmUpProgress(done->fetchAndAddOrdered(1)+1,total);
+    }
+
+private:
+    TemplateCache* cache;
+    QString name;
+    QAtomicInt* done;
+    int total;
+};
+
+} // end of namespace
 
 using namespace stefanfrings;
 
@@ -10,6 +41,16 @@ TemplateCache::TemplateCache(const QSettings* settings, QObject* parent)
 {
     cache.setMaxCost(settings->value("cacheSize","1000000").toInt());
     cacheTimeout=settings->value("cacheTime","60000").toInt();
+    watcher=nullptr;
+    sweepLimit=64;
+    if (settings->value("cacheWatch",false).toBool())
+    {
+        // Entries live until their file changes
+        cacheTimeout=0;
+        watcher=new QFileSystemWatcher(this);
+        connect(watcher,&QFileSystemWatcher::fileChanged,this,&TemplateCache::fileChanged);
+        connect(watcher,&QFileSystemWatcher::directoryChanged,this,&TemplateCache::directoryChanged);
+    }
     long int cacheMaxCost=(long int)cache.maxCost();
     qDebug("TemplateCache: timeout=%i, size=%li",cacheTimeout,cacheMaxCost);
 }
@@ -23,16 +64,178 @@ QString TemplateCache::tryFile(const QString localizedName)
     CacheEntry* entry=cache.object(localizedName);
     if (entry && (cacheTimeout==0 || entry->created>now-cacheTimeout))
     {
+        QString document=entry->document;
         mutex.unlock();
-        return entry->document;
+        return document;
     }
-    // search on filesystem
+    mutex.unlock();
+    // search on filesystem, without blocking other threads
+    QDateTime modified=QFileInfo(templatePath+"/"+localizedName+fileNameSuffix).lastModified();
     entry=new CacheEntry();
     entry->created=now;
     entry->document=TemplateLoader::tryFile(localizedName);
+    // Copy the document before, because the cache deletes entries that exceed its size
+    QString document=entry->document;
     // Store in cache even when the file did not exist, to remember that there is no such file
+    mutex.lock();
     cache.insert(localizedName,entry,entry->document.size());
     mutex.unlock();
-    return entry->document;
+    if (watcher)
+    {
+        // QFileSystemWatcher is not thread-safe, so let the thread of the cache add the watch
+        QMetaObject::invokeMethod(this,"watchFile",Qt::QueuedConnection,
+                                  Q_ARG(QString,localizedName),Q_ARG(QDateTime,modified));
+    }
+    return document;
+}
+
+void TemplateCache::warmUp()
+{
+    QElapsedTimer timer;
+    timer.start();
+    // Collect the template files, the cache key is the name relative to the template path without suffix
+    QStringList names;
+    QDirIterator iterator(templatePath,QStringList("*"+fileNameSuffix),QDir::Files|QDir::Readable,QDirIterator::Subdirectories);
+    while (iterator.hasNext())
+    {
+        QString fileName=iterator.next();
+        names.append(fileName.mid(templatePath.size()+1,fileName.size()-templatePath.size()-1-fileNameSuffix.size()));
+    }
+    // Load them in parallel
+    QThreadPool pool;
+    QAtomicInt done;
+    for (const QString& name : qAsConst(names))
+    {
+        pool.start(new TemplateWarmUpTask(this,name,&done,names.size()));
+    }
+    pool.waitForDone();
+    qDebug("TemplateCache: warmed up %i templates in %lli ms",names.size(),static_cast<long long>(timer.elapsed()));
+}
+
+void TemplateCache::watchFile(const QString localizedName, const QDateTime modified)
+{
+    QString fileName=templatePath+"/"+localizedName+fileNameSuffix;
+    if (fileName.startsWith(":"))
+    {
+        // Qt resources cannot change
+        return;
+    }
+    QFileInfo info(fileName);
+    WatchedFile& file=watched[fileName];
+    if (file.names.isEmpty())
+    {
+        if (info.exists())
+        {
+            watcher->addPath(fileName);
+        }
+        file.modified=modified;
+        // New files appear in the directory
+        QSet<QString>& files=watchedDirectories[info.absolutePath()];
+        if (files.isEmpty())
+        {
+            watcher->addPath(info.absolutePath());
+        }
+        files.insert(fileName);
+    }
+    if (!file.names.contains(localizedName))
+    {
+        file.names.append(localizedName);
+    }
+    // The file might have changed before the watch started
+    if (file.modified!=modified || info.lastModified()!=modified)
+    {
+        invalidate(QStringList(fileName));
+        return;
+    }
+    // Entries leave the cache silently, so look for unused watches when their number doubled
+    if (watched.size()>sweepLimit)
+    {
+        sweepWatches();
+    }
 }
 
+void TemplateCache::fileChanged(const QString fileName)
+{
+    invalidate(QStringList(fileName));
+}
+
+void TemplateCache::directoryChanged(const QString directory)
+{
+    // Only files that have been created, replaced or removed
+    QStringList changed;
+    const QSet<QString> fileNames=watchedDirectories.value(directory);
+    for (const QString& fileName : fileNames)
+    {
+        if (QFileInfo(fileName).lastModified()!=watched[fileName].modified)
+        {
+            changed.append(fileName);
+        }
+    }
+    invalidate(changed);
+}
+
+void TemplateCache::invalidate(const QStringList fileNames)
+{
+    QList<QString> names;
+    for (const QString& fileName : fileNames)
+    {
+        if (!watched.contains(fileName))
+        {
+            continue;
+        }
+        qDebug("TemplateCache: %s changed",qPrintable(fileName));
+        names.append(watched.value(fileName).names);
+        unwatch(fileName);
+    }
+    if (names.isEmpty())
+    {
+        return;
+    }
+    mutex.lock();
+    for (const QString& name : qAsConst(names))
+    {
+        cache.remove(name);
+    }
+    mutex.unlock();
+}
+
+void TemplateCache::unwatch(const QString fileName)
+{
+    watched.remove(fileName);
+    watcher->removePath(fileName);
+    QString directory=QFileInfo(fileName).absolutePath();
+    QSet<QString>& files=watchedDirectories[directory];
+    files.remove(fileName);
+    if (files.isEmpty())
+    {
+        watchedDirectories.remove(directory);
+        watcher->removePath(directory);
+    }
+}
+
+void TemplateCache::sweepWatches()
+{
+    QStringList unused;
+    mutex.lock();
+    for (auto file=watched.begin(); file!=watched.end(); ++file)
+    {
+        QList<QString>& names=file->names;
+        for (int i=names.size()-1; i>=0; --i)
+        {
+            if (!cache.contains(names.at(i)))
+            {
+                names.removeAt(i);
+            }
+        }
+        if (names.isEmpty())
+        {
+            unused.append(file.key());
+        }
+    }
+    mutex.unlock();
+    for (const QString& fileName : qAsConst(unused))
+    {
+        unwatch(fileName);
+    }
+    sweepLimit=qMax(2*watched.size(),64);
+}
@@ -2,6 +2,11 @@
 #define TEMPLATECACHE_H
 
 #include <QCache>
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
 #include "templateglobal.h"
 #include "templateloader.h"
 
@@ -33,17 +38,27 @@ namespace stefanfrings {
   encoding=UTF-8
   cacheSize=1000000
   cacheTime=60000
+  ;cacheWatch=true
   </pre></code>
   The path is relative to the directory of the config file. In case of windows, if the
   settings are in the registry, the path is relative to the current working directory.
   <p>
   Files are cached as long as possible, when cacheTime=0.
+  <p>
+  Call warmUp() at startup to load all templates before the first requests arrive.
+  <p>
+  With cacheWatch=true, cached files do not expire by time. A QFileSystemWatcher (inotify
+  on Linux) observes the loaded files and their directories instead, and removes exactly the
+  changed files from the cache. New files in a directory also invalidate the remembered
+  absence of files. Files that the cache dropped to make room for others are no longer
+  watched. This requires an event loop in the thread that created the cache.
   @see TemplateLoader
 */
 
 class DECLSPEC TemplateCache : public TemplateLoader {
     Q_OBJECT
     Q_DISABLE_COPY(TemplateCache)
+    friend class TemplateWarmUpTask;
 public:
 
     /**
@@ -58,6 +73,21 @@ public:
     */
     TemplateCache(const QSettings* settings, QObject* parent=nullptr);
 
+    /**
+      Load all template files into the cache, in parallel by a pool of threads.
+      Emits warmUpProgress() for each loaded file. This method is thread safe.
+    */
+    void warmUp();
+
+signals:
+
+    /**
+      Emitted by warmUp() while loading files, maybe by other threads.
+      @param done Number of files loaded so far
+      @param total Number of files to load
+    */
+    void warmUpProgress(int done, int total);
+
 protected:
 
     /**
@@ -67,6 +97,21 @@ protected:
     */
     virtual QString tryFile(const QString localizedName);
 
+private slots:
+
+    /**
+      Start watching a file that has been added to the cache. Called in the thread of the cache.
+      @param localizedName Name of the template with locale, which is the cache key
+      @param modified Modification time of the cached content, invalid if the file does not exist
+    */
+    void watchFile(const QString localizedName, const QDateTime modified);
+
+    /** Called by the watcher when a file has been modified or removed */
+    void fileChanged(const QString fileName);
+
+    /** Called by the watcher when files have been added, removed or renamed in a directory */
+    void directoryChanged(const QString directory);
+
 private:
 
     struct CacheEntry {
@@ -74,6 +119,23 @@ private:
         qint64 created;
     };
 
+    /** A loaded file that is watched for changes */
+    struct WatchedFile {
+        /** Names of the templates with locale, which are the cache keys */
+        QList<QString> names;
+        /** Modification time of the cached content, invalid if the file did not exist */
+        QDateTime modified;
+    };
+
+    /** Remove the entries of some files from the cache */
+    void invalidate(const QStringList fileNames);
+
+    /** Stop watching a file, and its directory if no other files in there are watched */
+    void unwatch(const QString fileName);
+
+    /** Stop watching the files whose entries have been dropped by the cache to make room for others */
+    void sweepWatches();
+
     /** Timeout for each cached file */
     int cacheTimeout;
 
@@ -82,6 +144,18 @@ private:
 
     /** Used to synchronize threads */
     QMutex mutex;
+
+    /** Watches the cached files, NULL if cacheWatch is disabled */
+    QFileSystemWatcher* watcher;
+
+    /** Watched files, key is the file name. Used only by the thread of the cache. */
+    QHash<QString,WatchedFile> watched;
+
+    /** Names of the watched files, key is the directory. Used only by the thread of the cache. */
+    QHash<QString,QSet<QString> > watchedDirectories;
+
+    /** Number of watched files that triggers the next sweep for files that left the cache */
+    int sweepLimit;
 };
 
 } // end of namespace